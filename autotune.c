@@ -0,0 +1,439 @@
+// Per-host tuning for encrypt, decrypt and keygen. The best numtheory backend,
+// sliding window width, hex kernel and block pipeline shape depend on the CPU,
+// so autotune_run() times each candidate on the key actually being used and
+// keeps the fastest. It goes one setting at a time, each with the winners so far:
+// backend and window on pow_mod, the hex kernel on encoding and decoding, then
+// the number of pipeline workers, the batch size and the queue depth on a
+// stream of blocks. Every candidate gets the same short time budget and each is
+// run ROUNDS times, keeping its best, so a noisy moment doesn't pick it.
+//
+// Profiles are kept in the per-user cache directory in a file named after the
+// host, one line per program and key size, together with the CPU model they
+// were tuned on. A profile is only loaded back on the same CPU model, and a
+// backend chosen with make BACKEND= is kept over the one in the profile.
+#include "autotune.h"
+#include "numtheory.h"
+#include "backend.h"
+#include "hex.h"
+#include "keycache.h"
+#include "pipeline.h"
+
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BUDGET      30000000u // ns per candidate for pow_mod and hex
+#define PIPE_BUDGET 100000000u // ns of blocks per pipeline candidate
+#define ROUNDS      3
+#define BASES       8
+#define HEX_BYTES   4096
+
+// The backends and window widths tried, in order; ties go to the earlier one
+static const struct {
+    const char *backend;
+    unsigned window;
+} arithmetics[] = {
+    { "native", 0 },
+    { "gmp", 0 },
+    { "fast", 0 },
+    { "fast", 1 },
+    { "fast", 2 },
+    { "fast", 3 },
+    { "fast", 4 },
+    { "fast", 5 },
+    { "fast", 6 },
+    { "fast", 7 },
+};
+
+#define ARITHMETICS (sizeof(arithmetics) / sizeof(arithmetics[0]))
+
+static const char *kernels[] = { "scalar", "sse2", "avx2" };
+
+#define KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+static const size_t batches[] = { 1, 4, 16, 64 };
+static const size_t depths[] = { 1, 2, 4, 8 };
+
+#define CHOICES 4
+
+// Whether make BACKEND= asked for a backend other than the default one
+#if defined(BACKEND_GMP) || defined(BACKEND_FAST)
+#define BACKEND_CHOSEN true
+#else
+#define BACKEND_CHOSEN false
+#endif
+
+// This function reads the monotonic clock
+// Inputs: void
+// Outputs: the time in nanoseconds
+
+static uint64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+// The cpu_model() function finds the name of this host's CPU
+// Inputs: model = output, its size
+// Outputs: void
+
+static void cpu_model(char model[], size_t size) {
+    snprintf(model, size, "unknown");
+    FILE *cpuinfo = fopen("/proc/cpuinfo", "r");
+    if (cpuinfo == NULL) {
+        return;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), cpuinfo) != NULL) {
+        char *colon = strchr(line, ':');
+        if (strncmp(line, "model name", 10) == 0 && colon != NULL) {
+            colon += strspn(colon + 1, " \t") + 1;
+            colon[strcspn(colon, "\n")] = '\0';
+            snprintf(model, size, "%s", colon);
+            break;
+        }
+    }
+    fclose(cpuinfo);
+    return;
+}
+
+// The profile_path() function builds the path of this host's profile file
+// Inputs: path = output of PATH_MAX characters
+// Outputs: true if there is a usable cache directory
+
+static bool profile_path(char path[]) {
+    char dir[PATH_MAX];
+    char host[256] = "localhost";
+    if (!keycache_dir(dir)) {
+        return false;
+    }
+    gethostname(host, sizeof(host) - 1);
+    host[sizeof(host) - 1] = '\0';
+    host[strcspn(host, "/")] = '\0';
+    return snprintf(path, PATH_MAX, "%s/autotune-%s", dir, host) < PATH_MAX;
+}
+
+// The parse() function reads one line of a profile file
+// Inputs: the line, p = output, op and bits = outputs, model = output of size
+// characters
+// Outputs: true if the line is well formed
+
+static bool parse(char line[], Profile *p, char op[16], uint64_t *bits, char model[], size_t size) {
+    int end = 0;
+    line[strcspn(line, "\n")] = '\0';
+    if (sscanf(line, "%15s %" SCNu64 " %15s %u %15s %zu %zu %zu %n", op, bits, p->backend, &p->window,
+            p->kernel, &p->batch, &p->depth, &p->workers, &end)
+            != 8
+        || end == 0) {
+        return false;
+    }
+    snprintf(model, size, "%s", line + end);
+    return true;
+}
+
+// The autotune_load() function finds the profile tuned for a program and key
+// size on this host. If the build chose a backend other than the default, the
+// profile keeps that one, and its window width only if it is for that backend.
+// Inputs: p = output, the program name and the key size in bits
+// Outputs: true if there is one for this CPU model
+
+bool autotune_load(Profile *p, const char *op, uint64_t bits) {
+    char path[PATH_MAX];
+    char cpu[256], model[256], line[512], name[16];
+    uint64_t size = 0;
+    if (!profile_path(path)) {
+        return false;
+    }
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return false;
+    }
+    cpu_model(cpu, sizeof(cpu));
+    bool found = false;
+    while (!found && fgets(line, sizeof(line), file) != NULL) {
+        found = parse(line, p, name, &size, model, sizeof(model)) && strcmp(name, op) == 0
+                && size == bits && strcmp(model, cpu) == 0;
+    }
+    fclose(file);
+    if (found && BACKEND_CHOSEN && strcmp(p->backend, numtheory_backend()) != 0) {
+        snprintf(p->backend, sizeof(p->backend), "%s", numtheory_backend());
+        p->window = 0;
+    }
+    return found;
+}
+
+// The autotune_save() function stores a profile for a program and key size,
+// replacing the one tuned before on this CPU model. The file is rewritten
+// under a temporary name and renamed, so other runs never see half of it.
+// Inputs: the profile, the program name and the key size in bits
+// Outputs: true if it was saved
+
+bool autotune_save(const Profile *p, const char *op, uint64_t bits) {
+    char path[PATH_MAX], tmp[PATH_MAX];
+    char cpu[256], model[256], line[512], copy[512], name[16];
+    uint64_t size = 0;
+    Profile old;
+    if (!profile_path(path) || snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= PATH_MAX) {
+        return false;
+    }
+    int fd = mkstemp(tmp);
+    FILE *out = (fd < 0) ? NULL : fdopen(fd, "w");
+    if (out == NULL) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp);
+        }
+        return false;
+    }
+    cpu_model(cpu, sizeof(cpu));
+
+    // keep every other profile
+    FILE *in = fopen(path, "r");
+    while (in != NULL && fgets(line, sizeof(line), in) != NULL) {
+        strcpy(copy, line);
+        if (parse(line, &old, name, &size, model, sizeof(model))
+            && !(strcmp(name, op) == 0 && size == bits && strcmp(model, cpu) == 0)) {
+            fputs(copy, out);
+        }
+    }
+    if (in != NULL) {
+        fclose(in);
+    }
+    fprintf(out, "%s %" PRIu64 " %s %u %s %zu %zu %zu %s\n", op, bits, p->backend, p->window,
+        p->kernel, p->batch, p->depth, p->workers, cpu);
+    if (fclose(out) != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return false;
+    }
+    return true;
+}
+
+// The autotune_apply() function switches to a profile's backend, window width
+// and hex kernel. The pipeline settings are left to the caller, since flags
+// given on the command line should win over them.
+// Inputs: the profile
+// Outputs: void
+
+void autotune_apply(const Profile *p) {
+    set_backend(p->backend);
+    set_window_width(p->window);
+    hex_set_kernel(p->kernel);
+    return;
+}
+
+// The autotune_print() function shows a profile on stderr
+// Inputs: the profile and where it came from
+// Outputs: void
+
+void autotune_print(const Profile *p, const char *how) {
+    fprintf(stderr, "autotune (%s): backend %s, window %u, hex %s, batch %zu, depth %zu, workers %zu\n",
+        how, p->backend, p->window, p->kernel, p->batch, p->depth, p->workers);
+    return;
+}
+
+// The time_pow() function times pow_mod with the current backend
+// Inputs: the bases, the exponent and the modulus
+// Outputs: nanoseconds per call
+
+static uint64_t time_pow(mpz_t bases[], mpz_t exponent, mpz_t modulus) {
+    mpz_t out;
+    mpz_init(out);
+    uint64_t calls = 0;
+    uint64_t start = now(), elapsed = 0;
+    do {
+        pow_mod(out, bases[calls % BASES], exponent, modulus);
+        calls += 1;
+        elapsed = now() - start;
+    } while (elapsed < BUDGET || calls < 2);
+    mpz_clear(out);
+    return elapsed / calls;
+}
+
+// The time_hex() function times encoding and decoding with the current kernel
+// Inputs: bytes = scratch of HEX_BYTES, text = scratch of 2 * HEX_BYTES
+// Outputs: nanoseconds per round trip
+
+static uint64_t time_hex(uint8_t bytes[], char text[]) {
+    uint64_t calls = 0;
+    uint64_t start = now(), elapsed = 0;
+    do {
+        hex_encode(text, bytes, HEX_BYTES);
+        hex_decode(bytes, text, HEX_BYTES);
+        calls += 1;
+        elapsed = now() - start;
+    } while (elapsed < BUDGET);
+    return elapsed / calls;
+}
+
+// A synthetic stream of blocks for timing the pipeline
+typedef struct {
+    mpz_t *bases;
+    mpz_ptr exponent;
+    mpz_ptr modulus;
+    size_t count; // blocks in the stream
+    size_t read; // blocks read so far, touched only by the reader
+    char *text; // hex output, touched only by the writer
+} Stream;
+
+// The stream_read() function reads the next block of the stream
+// Inputs: the stream, block = output
+// Outputs: false at the end
+
+static bool stream_read(void *ctx, mpz_t block) {
+    Stream *s = (Stream *) ctx;
+    if (s->read == s->count) {
+        return false;
+    }
+    mpz_set(block, s->bases[s->read % BASES]);
+    s->read += 1;
+    return true;
+}
+
+// The stream_block() function exponentiates one block of the stream
+// Inputs: the stream, out = output, the block
+// Outputs: void
+
+static void stream_block(void *ctx, mpz_t out, mpz_t in) {
+    Stream *s = (Stream *) ctx;
+    pow_mod(out, in, s->exponent, s->modulus);
+    return;
+}
+
+// The stream_write() function formats a block the way it would be written
+// Inputs: the stream and the block
+// Outputs: void
+
+static void stream_write(void *ctx, mpz_t block) {
+    Stream *s = (Stream *) ctx;
+    mpz_get_str(s->text, 16, block);
+    return;
+}
+
+// The time_pipeline() function times the stream through one pipeline shape
+// Inputs: the stream and the shape
+// Outputs: nanoseconds for the whole stream
+
+static uint64_t time_pipeline(Stream *s, size_t batch, size_t depth, size_t workers) {
+    pipeline_set(batch, depth, workers);
+    s->read = 0;
+    uint64_t start = now();
+    pipeline_run(stream_read, stream_block, stream_write, s);
+    return now() - start;
+}
+
+// The autotune_run() function times the candidates for this key and leaves the
+// fastest of each in p, switching to them as it goes
+// Inputs: p = output, the exponent and modulus of the key, and whether to tune
+// the hex kernel and the block pipeline too
+// Outputs: void
+
+void autotune_run(Profile *p, mpz_t exponent, mpz_t modulus, bool blocks) {
+    gmp_randstate_t rand;
+    gmp_randinit_default(rand); // the caller's random state is left alone
+    mpz_t bases[BASES];
+    for (int i = 0; i < BASES; i += 1) {
+        mpz_init(bases[i]);
+        mpz_urandomm(bases[i], rand, modulus);
+    }
+    snprintf(p->backend, sizeof(p->backend), "%s", numtheory_backend());
+    p->window = 0;
+    snprintf(p->kernel, sizeof(p->kernel), "%s", hex_kernel());
+    p->batch = 16;
+    p->depth = 4;
+    p->workers = 1;
+
+    // backend and window width
+    uint64_t best[ARITHMETICS];
+    for (size_t k = 0; k < ARITHMETICS; k += 1) {
+        best[k] = UINT64_MAX;
+    }
+    for (int r = 0; r < ROUNDS; r += 1) {
+        for (size_t k = 0; k < ARITHMETICS; k += 1) {
+            set_backend(arithmetics[k].backend);
+            set_window_width(arithmetics[k].window);
+            uint64_t ns = time_pow(bases, exponent, modulus);
+            best[k] = (ns < best[k]) ? ns : best[k];
+        }
+    }
+    size_t win = 0;
+    for (size_t k = 1; k < ARITHMETICS; k += 1) {
+        win = (best[k] < best[win]) ? k : win;
+    }
+    snprintf(p->backend, sizeof(p->backend), "%s", arithmetics[win].backend);
+    p->window = arithmetics[win].window;
+    uint64_t per_block = best[win];
+    autotune_apply(p);
+
+    if (blocks) {
+        // hex kernel, of those the CPU runs
+        uint8_t *bytes = (uint8_t *) calloc(HEX_BYTES, 1);
+        char *text = (char *) malloc(2 * HEX_BYTES);
+        uint64_t fastest = UINT64_MAX;
+        for (size_t k = 0; k < KERNELS; k += 1) {
+            if (!hex_set_kernel(kernels[k])) {
+                continue;
+            }
+            for (int r = 0; r < ROUNDS; r += 1) {
+                uint64_t ns = time_hex(bytes, text);
+                if (ns < fastest) {
+                    fastest = ns;
+                    snprintf(p->kernel, sizeof(p->kernel), "%s", kernels[k]);
+                }
+            }
+        }
+        hex_set_kernel(p->kernel);
+        free(bytes);
+        free(text);
+
+        // pipeline workers up to the number of CPUs, then batch size and
+        // queue depth with them
+        Stream s = { .bases = bases, .exponent = exponent, .modulus = modulus };
+        s.count = PIPE_BUDGET / (per_block ? per_block : 1);
+        s.count = (s.count < 32) ? 32 : (s.count > 4096) ? 4096 : s.count;
+        s.text = (char *) malloc(mpz_sizeinbase(modulus, 16) + 2);
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        size_t most = (cpus > 1) ? (size_t) cpus : 1;
+
+        fastest = UINT64_MAX;
+        for (size_t workers = 0; workers <= most; workers = workers ? 2 * workers : 1) {
+            for (int r = 0; r < ROUNDS; r += 1) {
+                uint64_t ns = time_pipeline(&s, p->batch, p->depth, workers);
+                if (ns < fastest) {
+                    fastest = ns;
+                    p->workers = workers;
+                }
+            }
+        }
+        // the batch size and depth don't matter without worker threads
+        for (int k = 0; p->workers > 0 && k < CHOICES && 4 * batches[k] <= s.count; k += 1) {
+            for (int r = 0; r < ROUNDS; r += 1) {
+                uint64_t ns = time_pipeline(&s, batches[k], p->depth, p->workers);
+                if (ns < fastest) {
+                    fastest = ns;
+                    p->batch = batches[k];
+                }
+            }
+        }
+        for (int k = 0; p->workers > 0 && k < CHOICES; k += 1) {
+            for (int r = 0; r < ROUNDS; r += 1) {
+                uint64_t ns = time_pipeline(&s, p->batch, depths[k], p->workers);
+                if (ns < fastest) {
+                    fastest = ns;
+                    p->depth = depths[k];
+                }
+            }
+        }
+        pipeline_set(p->batch, p->depth, p->workers);
+        free(s.text);
+    }
+
+    for (int i = 0; i < BASES; i += 1) {
+        mpz_clear(bases[i]);
+    }
+    gmp_randclear(rand);
+    return;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <gmp.h>
+
+// The settings autotune picks for one program and key size on this host
+typedef struct {
+    char backend[16]; // numtheory backend, see set_backend()
+    unsigned window; // sliding window width for the fast backend, 0 picks by size
+    char kernel[16]; // hex kernel, see hex_set_kernel()
+    size_t batch; // block pipeline, see pipeline_set()
+    size_t depth;
+    size_t workers;
+} Profile;
+
+bool autotune_load(Profile *p, const char *op, uint64_t bits);
+
+bool autotune_save(const Profile *p, const char *op, uint64_t bits);
+
+void autotune_run(Profile *p, mpz_t exponent, mpz_t modulus, bool blocks);
+
+void autotune_apply(const Profile *p);
+
+void autotune_print(const Profile *p, const char *how);
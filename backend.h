@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <gmp.h>
+
+// Every arithmetic backend behind numtheory.h. numtheory.c forwards to the one
+// chosen at build time, and ntbench runs them side by side.
+
+void gcd_native(mpz_t d, mpz_t a, mpz_t b);
+
+void mod_inverse_native(mpz_t i, mpz_t a, mpz_t n);
+
+void pow_mod_native(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus);
+
+bool is_prime_native(mpz_t n, uint64_t iters);
+
+void gcd_gmp(mpz_t d, mpz_t a, mpz_t b);
+
+void mod_inverse_gmp(mpz_t i, mpz_t a, mpz_t n);
+
+void pow_mod_gmp(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus);
+
+bool is_prime_gmp(mpz_t n, uint64_t iters);
+
+void gcd_fast(mpz_t d, mpz_t a, mpz_t b);
+
+void mod_inverse_fast(mpz_t i, mpz_t a, mpz_t n);
+
+void pow_mod_fast(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus);
+
+void set_window_width(unsigned width);
+
+bool is_prime_fast(mpz_t n, uint64_t iters);
@@ -0,0 +1,282 @@
+// Bernstein's batch GCD: finds, for every modulus n_i in a collection, the gcd
+// of n_i with the product of all the others, in quasi-linear time instead of
+// comparing every pair. A product tree multiplies the moduli together pairwise
+// up to their product P, and a remainder tree takes P back down modulo the
+// square of every node, leaving z_i = P mod n_i^2 at the leaves. Then
+// gcd(z_i / n_i, n_i) is the part of n_i shared with some other modulus.
+//
+// Every level of both trees is split across threads. Each level is about as
+// big as all the moduli put together, so with many keys the levels that aren't
+// being worked on can be spilled to temporary files and read back on the way
+// down, keeping only about three levels in memory.
+#include "batchgcd.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// One level of a tree, in memory or spilled to a file
+typedef struct {
+    mpz_t *v;
+    size_t count;
+    FILE *spill; // holds the level while v is NULL
+} Level;
+
+// What the threads working on one level share
+typedef struct {
+    void (*step)(void *ctx, size_t i);
+    void *ctx;
+    size_t count;
+    _Atomic size_t next;
+} Job;
+
+// The worker() function runs steps of a job until there are none left
+// Inputs: the job
+// Outputs: NULL
+
+static void *worker(void *arg) {
+    Job *job = (Job *) arg;
+    size_t i;
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->count) {
+        job->step(job->ctx, i);
+    }
+    return NULL;
+}
+
+// The parallel() function runs step(ctx, i) for every i below count on threads
+// Inputs: the step, its context, the count and the number of threads
+// Outputs: void
+
+static void parallel(void (*step)(void *, size_t), void *ctx, size_t count, int threads) {
+    Job job = { .step = step, .ctx = ctx, .count = count };
+    atomic_init(&job.next, 0);
+    threads = ((size_t) threads > count) ? (int) count : threads;
+    pthread_t *tids = (pthread_t *) calloc((size_t) (threads > 1 ? threads : 1), sizeof(pthread_t));
+    // this thread works too, and finishes the job alone if no other starts
+    int started = 1;
+    while (started < threads && pthread_create(&tids[started], NULL, worker, &job) == 0) {
+        started += 1;
+    }
+    worker(&job);
+    for (int t = 1; t < started; t += 1) {
+        pthread_join(tids[t], NULL);
+    }
+    free(tids);
+    return;
+}
+
+// The level_new() function makes an empty level
+// Inputs: the level and its size
+// Outputs: void
+
+static void level_new(Level *l, size_t count) {
+    l->count = count;
+    l->spill = NULL;
+    l->v = (mpz_t *) malloc(count * sizeof(mpz_t));
+    for (size_t i = 0; i < count; i += 1) {
+        mpz_init(l->v[i]);
+    }
+    return;
+}
+
+// The level_free() function frees a level in memory and any spill file
+// Inputs: the level
+// Outputs: void
+
+static void level_free(Level *l) {
+    if (l->v != NULL) {
+        for (size_t i = 0; i < l->count; i += 1) {
+            mpz_clear(l->v[i]);
+        }
+        free(l->v);
+        l->v = NULL;
+    }
+    if (l->spill != NULL) {
+        fclose(l->spill);
+        l->spill = NULL;
+    }
+    return;
+}
+
+// The level_spill() function moves a level out to an unnamed file in dir,
+// which disappears when it is closed
+// Inputs: the level and the directory
+// Outputs: true if the level was written
+
+static bool level_spill(Level *l, const char *dir) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/keyaudit.XXXXXX", dir);
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return false;
+    }
+    unlink(path);
+    FILE *f = fdopen(fd, "w+b");
+    if (f == NULL) {
+        close(fd);
+        return false;
+    }
+    bool ok = true;
+    for (size_t i = 0; i < l->count && ok; i += 1) {
+        ok = mpz_out_raw(f, l->v[i]) > 0;
+    }
+    ok = ok && fflush(f) == 0;
+    if (!ok) {
+        fclose(f);
+        return false;
+    }
+    size_t count = l->count;
+    level_free(l);
+    l->count = count;
+    l->spill = f;
+    return true;
+}
+
+// The level_load() function reads a spilled level back into memory
+// Inputs: the level
+// Outputs: true if it was read back whole
+
+static bool level_load(Level *l) {
+    if (l->spill == NULL) {
+        return true;
+    }
+    FILE *f = l->spill;
+    l->spill = NULL;
+    level_new(l, l->count);
+    rewind(f);
+    bool ok = true;
+    for (size_t i = 0; i < l->count && ok; i += 1) {
+        ok = mpz_inp_raw(l->v[i], f) > 0;
+    }
+    fclose(f);
+    return ok;
+}
+
+// Context for the tree steps: the level below, the level above, and for the
+// remainder tree the products of the level being computed
+typedef struct {
+    Level *below;
+    Level *above;
+    Level *products;
+} Trees;
+
+// The product_step() function multiplies two neighbours into their parent
+// Inputs: the trees, the parent index
+// Outputs: void
+
+static void product_step(void *ctx, size_t i) {
+    Trees *t = (Trees *) ctx;
+    if (2 * i + 1 < t->below->count) {
+        mpz_mul(t->above->v[i], t->below->v[2 * i], t->below->v[2 * i + 1]);
+    } else {
+        mpz_set(t->above->v[i], t->below->v[2 * i]);
+    }
+    return;
+}
+
+// The remainder_step() function reduces a parent's remainder modulo the
+// square of a child
+// Inputs: the trees, the child index
+// Outputs: void
+
+static void remainder_step(void *ctx, size_t i) {
+    Trees *t = (Trees *) ctx;
+    mpz_t square;
+    mpz_init(square);
+    mpz_mul(square, t->products->v[i], t->products->v[i]);
+    mpz_mod(t->below->v[i], t->above->v[i / 2], square);
+    mpz_clear(square);
+    return;
+}
+
+// Context for the last step
+typedef struct {
+    mpz_t *out;
+    mpz_t *moduli;
+    Level *remainders;
+} Leaves;
+
+// The leaf_step() function turns z = P mod n^2 into gcd(z / n, n)
+// Inputs: the leaves, the index
+// Outputs: void
+
+static void leaf_step(void *ctx, size_t i) {
+    Leaves *l = (Leaves *) ctx;
+    mpz_divexact(l->out[i], l->remainders->v[i], l->moduli[i]);
+    mpz_gcd(l->out[i], l->out[i], l->moduli[i]);
+    return;
+}
+
+// The batch_gcd() function finds, for each modulus, its gcd with the product of
+// all the others. Anything but 1 means that modulus shares a prime.
+// Inputs: out = output (count values, initialized), the moduli and how many,
+// the number of threads, a directory for spill files (NULL never spills), and
+// how many bytes of tree to keep in memory before spilling
+// Outputs: true, or false if a spill file couldn't be written or read
+
+bool batch_gcd(mpz_t out[], mpz_t moduli[], size_t count, int threads, const char *spill, size_t budget) {
+    if (count == 0) {
+        return true;
+    }
+
+    // every level is about the size of all the moduli together
+    size_t height = 1;
+    size_t bytes = 0;
+    for (size_t i = 0; i < count; i += 1) {
+        bytes += mpz_size(moduli[i]) * sizeof(mp_limb_t);
+    }
+    for (size_t c = count; c > 1; c = (c + 1) / 2) {
+        height += 1;
+    }
+    bool spilling = spill != NULL && bytes * height > budget;
+
+    // product tree: level 0 is a copy of the moduli, the top is their product
+    Level *tree = (Level *) calloc(height, sizeof(Level));
+    level_new(&tree[0], count);
+    for (size_t i = 0; i < count; i += 1) {
+        mpz_set(tree[0].v[i], moduli[i]);
+    }
+    bool ok = true;
+    for (size_t k = 1; k < height && ok; k += 1) {
+        level_new(&tree[k], (tree[k - 1].count + 1) / 2);
+        Trees t = { .below = &tree[k - 1], .above = &tree[k] };
+        parallel(product_step, &t, tree[k].count, threads);
+        if (spilling) {
+            ok = level_spill(&tree[k - 1], spill);
+        }
+    }
+
+    // remainder tree: down from the product, modulo the square of every node
+    Level above = tree[height - 1];
+    tree[height - 1].v = NULL;
+    for (size_t k = height - 1; k-- > 0 && ok;) {
+        ok = level_load(&tree[k]);
+        Level below;
+        level_new(&below, tree[k].count);
+        Trees t = { .below = &below, .above = &above, .products = &tree[k] };
+        if (ok) {
+            parallel(remainder_step, &t, below.count, threads);
+        }
+        level_free(&above);
+        level_free(&tree[k]);
+        above = below;
+    }
+
+    if (ok) {
+        if (height == 1) {
+            mpz_set_ui(out[0], 1); // a single modulus shares nothing
+        } else {
+            Leaves l = { .out = out, .moduli = moduli, .remainders = &above };
+            parallel(leaf_step, &l, count, threads);
+        }
+    }
+    level_free(&above);
+    for (size_t k = 0; k < height; k += 1) {
+        level_free(&tree[k]);
+    }
+    free(tree);
+    return ok;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <gmp.h>
+
+bool batch_gcd(mpz_t out[], mpz_t moduli[], size_t count, int threads, const char *spill, size_t budget);
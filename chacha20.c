@@ -0,0 +1,95 @@
+// ChaCha20 stream cipher as specified in RFC 8439
+#include "chacha20.h"
+
+#include <string.h>
+
+static inline uint32_t rotl(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+}
+
+static inline uint32_t load32(const uint8_t *p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+#define QUARTER(a, b, c, d)                                                                        \
+    do {                                                                                           \
+        a += b;                                                                                    \
+        d = rotl(d ^ a, 16);                                                                       \
+        c += d;                                                                                    \
+        b = rotl(b ^ c, 12);                                                                       \
+        a += b;                                                                                    \
+        d = rotl(d ^ a, 8);                                                                        \
+        c += d;                                                                                    \
+        b = rotl(b ^ c, 7);                                                                        \
+    } while (0)
+
+// The next_block() function makes 64 bytes of keystream and advances the counter
+// Inputs: the context
+// Outputs: void
+
+static void next_block(ChaCha20 *ctx) {
+    uint32_t x[16];
+    memcpy(x, ctx->state, sizeof(x));
+    for (int i = 0; i < 10; i += 1) {
+        QUARTER(x[0], x[4], x[8], x[12]);
+        QUARTER(x[1], x[5], x[9], x[13]);
+        QUARTER(x[2], x[6], x[10], x[14]);
+        QUARTER(x[3], x[7], x[11], x[15]);
+        QUARTER(x[0], x[5], x[10], x[15]);
+        QUARTER(x[1], x[6], x[11], x[12]);
+        QUARTER(x[2], x[7], x[8], x[13]);
+        QUARTER(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < 16; i += 1) {
+        uint32_t v = x[i] + ctx->state[i];
+        ctx->stream[4 * i] = (uint8_t) v;
+        ctx->stream[4 * i + 1] = (uint8_t) (v >> 8);
+        ctx->stream[4 * i + 2] = (uint8_t) (v >> 16);
+        ctx->stream[4 * i + 3] = (uint8_t) (v >> 24);
+    }
+    ctx->state[12] += 1;
+    ctx->used = 0;
+    return;
+}
+
+// The chacha20_init() function sets up a keystream starting at block counter 1
+// Inputs: the context, the key and the nonce
+// Outputs: void
+
+void chacha20_init(ChaCha20 *ctx, const uint8_t key[CHACHA20_KEY], const uint8_t nonce[CHACHA20_NONCE]) {
+    ctx->state[0] = 0x61707865; // "expand 32-byte k"
+    ctx->state[1] = 0x3320646e;
+    ctx->state[2] = 0x79622d32;
+    ctx->state[3] = 0x6b206574;
+    for (int i = 0; i < 8; i += 1) {
+        ctx->state[4 + i] = load32(key + 4 * i);
+    }
+    ctx->state[12] = 1;
+    for (int i = 0; i < 3; i += 1) {
+        ctx->state[13 + i] = load32(nonce + 4 * i);
+    }
+    ctx->used = sizeof(ctx->stream);
+    return;
+}
+
+// The chacha20_xor() function encrypts or decrypts buf in place. Calls can be
+// chained, the keystream carries on where the last call stopped.
+// Inputs: the context, the data and its length
+// Outputs: void
+
+void chacha20_xor(ChaCha20 *ctx, uint8_t *buf, size_t len) {
+    size_t i = 0;
+    while (i < len) {
+        if (ctx->used == sizeof(ctx->stream)) {
+            next_block(ctx);
+        }
+        size_t take = sizeof(ctx->stream) - ctx->used;
+        take = (take < len - i) ? take : len - i;
+        for (size_t j = 0; j < take; j += 1) {
+            buf[i + j] ^= ctx->stream[ctx->used + j];
+        }
+        ctx->used += take;
+        i += take;
+    }
+    return;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHACHA20_KEY   32 // bytes in a key
+#define CHACHA20_NONCE 12 // bytes in a nonce
+
+typedef struct {
+    uint32_t state[16];
+    uint8_t stream[64]; // keystream for the current block
+    size_t used; // bytes of stream already used
+} ChaCha20;
+
+void chacha20_init(ChaCha20 *ctx, const uint8_t key[CHACHA20_KEY], const uint8_t nonce[CHACHA20_NONCE]);
+
+void chacha20_xor(ChaCha20 *ctx, uint8_t *buf, size_t len);
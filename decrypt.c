@@ -2,6 +2,12 @@
 #include "randstate.h"
 #include "rsa.h"
 #include "set.h"
+#include "envelope.h"
+#include "lz.h"
+#include "metrics.h"
+#include "uring.h"
+#include "pipeline.h"
+#include "autotune.h"
 
 #include <stdio.h>
 #include <getopt.h>
@@ -22,19 +28,50 @@ void message(void) {
                     "\n"
                     "USAGE\n"
                     "   ./decrypt [-hv] [-i infile] [-o outfile] -n privkey\n"
+                    "             [--metrics-out file] [--metrics-threshold usec] [--io-uring]\n"
+                    "             [--batch blocks] [--queue-depth batches] [--workers count]\n"
+                    "             [--autotune]\n"
                     "\n"
                     "OPTIONS\n"
                     "   -h              Display program help and usage.\n"
                     "   -v              Display verbose program output.\n"
                     "   -i infile       Input file of data to decrypt (default: stdin).\n"
                     "   -o outfile      Output file for decrypted data (default: stdout).\n"
-                    "   -n pvfile       Private key file (default: rsa.priv).\n");
+                    "   -n pvfile       Private key file (default: rsa.priv).\n"
+                    "   --metrics-out file\n"
+                    "                   Write per-block latency histograms to file in the\n"
+                    "                   Prometheus text format.\n"
+                    "   --metrics-threshold usec\n"
+                    "                   Count blocks slower than usec (default: 1000).\n"
+                    "   --io-uring      Read and write regular files through io_uring, keeping\n"
+                    "                   several large requests in flight while blocks are\n"
+                    "                   computed. Falls back to stdio when unavailable.\n"
+                    "   --batch blocks  Blocks passed between pipeline stages at once (default: 16).\n"
+                    "   --queue-depth batches\n"
+                    "                   Batches queued between pipeline stages (default: 4).\n"
+                    "   --workers count Threads computing blocks while one thread reads and\n"
+                    "                   another writes (default: 1). 0 does it all in turn.\n"
+                    "   --autotune      Time the backends, window widths, hex kernels and\n"
+                    "                   pipeline settings on this key, use the fastest and\n"
+                    "                   remember them for this host and key size. Later runs\n"
+                    "                   load them unless given on the command line.\n");
     return;
 }
 
-typedef enum { VERBOSE } Decrypt;
+typedef enum { VERBOSE, URING, AUTOTUNE, BATCH, DEPTH, WORKERS } Decrypt;
 #define OPTIONS "hvn:i:o:"
 
+static struct option long_options[] = {
+    { "metrics-out", required_argument, NULL, 'M' },
+    { "metrics-threshold", required_argument, NULL, 'T' },
+    { "io-uring", no_argument, NULL, 'U' },
+    { "batch", required_argument, NULL, 'B' },
+    { "queue-depth", required_argument, NULL, 'Q' },
+    { "workers", required_argument, NULL, 'W' },
+    { "autotune", no_argument, NULL, 'A' },
+    { NULL, 0, NULL, 0 },
+};
+
 int main(int argc, char **argv) {
     // Declare default values and set
     Set chosen = empty_set();
@@ -45,11 +82,14 @@ int main(int argc, char **argv) {
     FILE *outfile = stdout;
     FILE *pvfile;
     char *pvpath = "rsa.priv";
+    char *metricspath = NULL;
+    uint64_t threshold = 1000;
+    size_t batch = 16, depth = 4, workers = 1;
 
     // Parse command line inputs
     // If help was chosen or something went wrong, send user to
     // the usage message and end the program
-    while ((option = getopt(argc, argv, OPTIONS)) != -1) {
+    while ((option = getopt_long(argc, argv, OPTIONS, long_options, NULL)) != -1) {
         switch (option) {
         case 'h':
             message();
@@ -80,6 +120,37 @@ int main(int argc, char **argv) {
                 return 1;
             }
             break;
+        case 'M':
+            // write latency metrics at the end
+            metricspath = optarg;
+            break;
+        case 'T':
+            // latency counted as slow, in microseconds
+            threshold = (uint64_t) strtoull(optarg, NULL, 10);
+            break;
+        case 'U':
+            // asynchronous file I/O
+            chosen = insert_set(URING, chosen);
+            break;
+        case 'B':
+            // blocks per pipeline batch
+            batch = (size_t) strtoull(optarg, NULL, 10);
+            chosen = insert_set(BATCH, chosen);
+            break;
+        case 'Q':
+            // batches per pipeline queue
+            depth = (size_t) strtoull(optarg, NULL, 10);
+            chosen = insert_set(DEPTH, chosen);
+            break;
+        case 'W':
+            // compute workers
+            workers = (size_t) strtoull(optarg, NULL, 10);
+            chosen = insert_set(WORKERS, chosen);
+            break;
+        case 'A':
+            // tune for this host and key size
+            chosen = insert_set(AUTOTUNE, chosen);
+            break;
         default:
             message();
             fclose(infile);
@@ -110,13 +181,117 @@ int main(int argc, char **argv) {
         gmp_printf("d (%d bits) = %Zd\n", mpz_sizeinbase(d, 2), d); // private key e
     }
 
-    // decrypt the file
-    rsa_decrypt_file(infile, outfile, n, d);
+    // tune for this host and key size if asked to, or use what was tuned before;
+    // pipeline settings given on the command line win
+    Profile profile;
+    uint64_t bits = mpz_sizeinbase(n, 2);
+    bool tuned = false;
+    if (member_set(AUTOTUNE, chosen)) {
+        autotune_run(&profile, d, n, true);
+        tuned = true;
+        if (!autotune_save(&profile, "decrypt", bits)) {
+            fprintf(stderr, "autotune: couldn't save the profile\n");
+        }
+    } else if (autotune_load(&profile, "decrypt", bits)) {
+        autotune_apply(&profile);
+        tuned = true;
+    }
+    if (tuned) {
+        batch = member_set(BATCH, chosen) ? batch : profile.batch;
+        depth = member_set(DEPTH, chosen) ? depth : profile.depth;
+        workers = member_set(WORKERS, chosen) ? workers : profile.workers;
+        if (member_set(VERBOSE, chosen)) {
+            profile.batch = batch;
+            profile.depth = depth;
+            profile.workers = workers;
+            autotune_print(&profile, member_set(AUTOTUNE, chosen) ? "tuned" : "cached");
+        }
+    }
+    pipeline_set(batch, depth, workers);
+
+    // time every block if asked to, after tuning so none of its blocks count
+    if (metricspath != NULL) {
+        metrics = metrics_create(threshold * 1000);
+    }
+
+    // keep reads and writes in flight while the blocks are computed, if asked to
+    if (member_set(URING, chosen)) {
+        FILE *in = uring_open(infile, "r");
+        FILE *out = uring_open(outfile, "w");
+        if (member_set(VERBOSE, chosen)) {
+            fprintf(stderr, "io_uring: input %s, output %s\n", (in != infile) ? "on" : "off (stdio)",
+                (out != outfile) ? "on" : "off (stdio)");
+        }
+        infile = in;
+        outfile = out;
+    }
+    // decrypt the file, which is plain blocks, or starts with a header line for
+    // compressed blocks or a multi-recipient envelope
+    int status = 0;
+    HexReader *r = hex_reader_create(infile);
+    char header[64] = "";
+    char magic[16] = "";
+    unsigned version = 0;
+    if (hex_peek(r) == 'R') {
+        if (!hex_read_line(r, header, sizeof(header))
+            || sscanf(header, "%15s %u", magic, &version) != 2) {
+            strcpy(magic, "?");
+        }
+    }
+    if (magic[0] == '\0') {
+        rsa_decrypt_hex(r, rsa_file_sink, outfile, n, d);
+    } else if (strcmp(magic, LZ_MAGIC) == 0 && version == LZ_VERSION) {
+        LZWriter *lz = lz_writer_create(outfile);
+        rsa_decrypt_hex(r, lz_write, lz, n, d);
+        if (!lz_writer_delete(&lz)) {
+            fprintf(stderr, "Error: corrupt compressed data.\n");
+            status = 1;
+        }
+    } else if (strcmp(magic, ENVELOPE_MAGIC) == 0) {
+        switch (envelope_decrypt_file(r, header, outfile, n, d)) {
+        case ENVELOPE_OK: break;
+        case ENVELOPE_MALFORMED:
+            fprintf(stderr, "Error: unsupported or malformed multi-recipient file.\n");
+            status = 1;
+            break;
+        case ENVELOPE_NO_SLOT:
+            fprintf(stderr, "Error: no recipient slot for this key.\n");
+            status = 1;
+            break;
+        case ENVELOPE_FORGED:
+            fprintf(stderr, "Error: the file was modified or cut short, nothing was decrypted.\n");
+            status = 1;
+            break;
+        case ENVELOPE_NO_SPOOL:
+            fprintf(stderr, "Error: no temporary file to check the payload in.\n");
+            status = 1;
+            break;
+        case ENVELOPE_CORRUPT:
+            fprintf(stderr, "Error: corrupt compressed data.\n");
+            status = 1;
+            break;
+        default: status = 1; break;
+        }
+    } else {
+        fprintf(stderr, "Error: unknown file format.\n");
+        status = 1;
+    }
+    hex_reader_delete(&r);
+    if (metrics != NULL) {
+        if (!metrics_write(metrics, metricspath)) {
+            fprintf(stderr, "%s: couldn't write metrics\n", metricspath);
+            status = 1;
+        }
+        metrics_delete(&metrics);
+    }
 
     // close all files and clear any variables
     mpz_clears(n, d, NULL);
     fclose(pvfile);
     fclose(infile);
-    fclose(outfile);
-    return 0;
+    if (fclose(outfile) != 0) {
+        fprintf(stderr, "Error: couldn't write the output.\n");
+        status = 1;
+    }
+    return status;
 }
@@ -4,8 +4,17 @@
 #include "randstate.h"
 #include "rsa.h"
 #include "set.h"
+#include "keycache.h"
+#include "keyring.h"
+#include "envelope.h"
+#include "lz.h"
+#include "metrics.h"
+#include "uring.h"
+#include "pipeline.h"
+#include "autotune.h"
 
 #include <stdio.h>
+#include <limits.h>
 #include <getopt.h>
 #include <errno.h>
 #include <inttypes.h>
@@ -23,19 +32,136 @@ void message(void) {
                     "   Encrypted data is decrypted by the decrypt program.\n"
                     "\n"
                     "USAGE\n"
-                    "   ./encrypt [-hv] [-i infile] [-o outfile] -n pubkey\n"
+                    "   ./encrypt [-hvCz] [-i infile] [-o outfile] [-K keyring] -n pubkey | -u user ...\n"
+                    "             [--metrics-out file] [--metrics-threshold usec] [--io-uring]\n"
+                    "             [--batch blocks] [--queue-depth batches] [--workers count]\n"
+                    "             [--autotune]\n"
                     "\n"
                     "OPTIONS\n"
                     "   -h              Display program help and usage.\n"
                     "   -v              Display verbose program output.\n"
+                    "   -C              Always verify the key, skip the verified-key cache.\n"
+                    "   -z              Compress the input first if it is compressible.\n"
                     "   -i infile       Input file of data to encrypt (default: stdin).\n"
                     "   -o outfile      Output file for encrypted data (default: stdout).\n"
-                    "   -n pbfile       Private key file (default: rsa.pub).\n");
+                    "   -n pbfile       Public key file (default: rsa.pub). Giving more than one\n"
+                    "                   encrypts the input once for all of the recipients.\n"
+                    "   -u user         Recipient whose public key is in the keyring. May be\n"
+                    "                   given more than once, and mixed with -n.\n"
+                    "   -K keyring      Keyring file for -u (default: rsa.keyring).\n"
+                    "   --metrics-out file\n"
+                    "                   Write per-block latency histograms to file in the\n"
+                    "                   Prometheus text format.\n"
+                    "   --metrics-threshold usec\n"
+                    "                   Count blocks slower than usec (default: 1000).\n"
+                    "   --io-uring      Read and write regular files through io_uring, keeping\n"
+                    "                   several large requests in flight while blocks are\n"
+                    "                   computed. Falls back to stdio when unavailable.\n"
+                    "   --batch blocks  Blocks passed between pipeline stages at once (default: 16).\n"
+                    "   --queue-depth batches\n"
+                    "                   Batches queued between pipeline stages (default: 4).\n"
+                    "   --workers count Threads computing blocks while one thread reads and\n"
+                    "                   another writes (default: 1). 0 does it all in turn.\n"
+                    "   --autotune      Time the backends, window widths, hex kernels and\n"
+                    "                   pipeline settings on this key, use the fastest and\n"
+                    "                   remember them for this host and key size. Later runs\n"
+                    "                   load them unless given on the command line.\n");
     return;
 }
 
-typedef enum { VERBOSE } Encrypt;
-#define OPTIONS "hvn:i:o:"
+typedef enum { VERBOSE, NOCACHE, COMPRESS, URING, AUTOTUNE, BATCH, DEPTH, WORKERS } Encrypt;
+#define OPTIONS "hvCzn:u:K:i:o:"
+
+static struct option long_options[] = {
+    { "metrics-out", required_argument, NULL, 'M' },
+    { "metrics-threshold", required_argument, NULL, 'T' },
+    { "io-uring", no_argument, NULL, 'U' },
+    { "batch", required_argument, NULL, 'B' },
+    { "queue-depth", required_argument, NULL, 'Q' },
+    { "workers", required_argument, NULL, 'W' },
+    { "autotune", no_argument, NULL, 'A' },
+    { NULL, 0, NULL, 0 },
+};
+
+// This function checks a public key's signature, unless this exact key was
+// verified before
+// Inputs: the key n, e, s and its username, where it came from (for errors),
+// and the chosen options
+// Outputs: true if the key is valid
+
+bool check_key(mpz_t n, mpz_t e, mpz_t s, char username[], char *from, Set chosen) {
+    // if verbose printing was chosen, print the needed values
+    if (member_set(VERBOSE, chosen)) {
+        gmp_printf("user = %s\n", username); // username
+        gmp_printf("s (%d bits) = %Zd\n", mpz_sizeinbase(s, 2), s); // signature
+        gmp_printf("n (%d bits) = %Zd\n", mpz_sizeinbase(n, 2), n); // public modulus n
+        gmp_printf("e (%d bits) = %Zd\n", mpz_sizeinbase(e, 2), e); // public exponent e
+    }
+
+    // verify signature (unless this exact key was verified before)
+    bool cached = !member_set(NOCACHE, chosen) && keycache_lookup(n, e, s, username);
+    bool verified = cached;
+    if (!cached) {
+        // convert the username that was read in to an mpz type variable
+        mpz_t name;
+        mpz_init(name);
+        mpz_set_str(name, username, 62);
+        verified = rsa_verify(name, s, e, n);
+        if (verified && !member_set(NOCACHE, chosen)) {
+            keycache_store(n, e, s, username);
+        }
+        mpz_clear(name);
+    }
+    if (member_set(VERBOSE, chosen)) {
+        printf("key verification %s\n", cached ? "cached" : "computed");
+    }
+    if (!verified) {
+        fprintf(stderr, "Error: invalid key %s.\n", from);
+    }
+    return verified;
+}
+
+// This function reads a public key file and checks its signature
+// Inputs: the public key file path, n and e = output carrying variables,
+// and the chosen options
+// Outputs: true if the key is valid
+
+bool load_key(char *pbpath, mpz_t n, mpz_t e, Set chosen) {
+    // Open the public file
+    FILE *pbfile = fopen(pbpath, "r");
+    if (pbfile == NULL) {
+        fprintf(stderr, "%s: No such file or directory\n", pbpath);
+        return false;
+    }
+
+    // read the public file
+    mpz_t s;
+    mpz_init(s);
+    char username[LOGIN_NAME_MAX];
+    rsa_read_pub(n, e, s, username, pbfile);
+    fclose(pbfile);
+
+    bool verified = check_key(n, e, s, username, pbpath, chosen);
+    mpz_clear(s);
+    return verified;
+}
+
+// This function finds a user's public key in the keyring and checks its signature
+// Inputs: the open keyring, the username, n and e = output carrying variables,
+// and the chosen options
+// Outputs: true if the user has a valid key
+
+bool find_key(Keyring *ring, char *user, mpz_t n, mpz_t e, Set chosen) {
+    mpz_t s;
+    mpz_init(s);
+    bool found = keyring_find_user(ring, user, n, e, s);
+    if (!found) {
+        fprintf(stderr, "Error: no key for %s in the keyring.\n", user);
+    }
+    bool verified = found && check_key(n, e, s, user, user, chosen);
+    mpz_clear(s);
+    return verified;
+}
 
 int main(int argc, char **argv) {
     // Declare default values and set
@@ -45,16 +171,25 @@ int main(int argc, char **argv) {
     // specify all the required files and default public file path
     FILE *infile = stdin;
     FILE *outfile = stdout;
-    FILE *pbfile;
     char *pbpath = "rsa.pub";
+    char *metricspath = NULL;
+    uint64_t threshold = 1000;
+    size_t batch = 16, depth = 4, workers = 1;
+    char **pbpaths = (char **) calloc(argc, sizeof(char *));
+    uint32_t count = 0;
+    char *ringpath = "rsa.keyring";
+    char **users = (char **) calloc(argc, sizeof(char *));
+    uint32_t ucount = 0;
 
     // Parse command line inputs
     // If help was chosen or something went wrong, send user to
     // the usage message and end the program
-    while ((option = getopt(argc, argv, OPTIONS)) != -1) {
+    while ((option = getopt_long(argc, argv, OPTIONS, long_options, NULL)) != -1) {
         switch (option) {
         case 'h':
             message();
+            free(pbpaths);
+            free(users);
             fclose(infile);
             fclose(outfile);
             return 0;
@@ -62,14 +197,34 @@ int main(int argc, char **argv) {
             // verbose printing was chosen
             chosen = insert_set(VERBOSE, chosen);
             break;
+        case 'C':
+            // bypass the verified-key cache
+            chosen = insert_set(NOCACHE, chosen);
+            break;
+        case 'z':
+            // compress before encrypting
+            chosen = insert_set(COMPRESS, chosen);
+            break;
         case 'n':
-            // public file path was specified
-            pbpath = optarg;
+            // public file path was specified, once per recipient
+            pbpaths[count] = optarg;
+            count += 1;
+            break;
+        case 'u':
+            // recipient from the keyring
+            users[ucount] = optarg;
+            ucount += 1;
+            break;
+        case 'K':
+            // keyring path specified
+            ringpath = optarg;
             break;
         case 'i':
             infile = fopen(optarg, "r");
             if (infile == NULL) {
                 fprintf(stderr, "Input file: No such file or directory\n");
+                free(pbpaths);
+                free(users);
                 fclose(infile);
                 fclose(outfile);
                 return 1;
@@ -79,60 +234,172 @@ int main(int argc, char **argv) {
             outfile = fopen(optarg, "w");
             if (outfile == NULL) {
                 fprintf(stderr, "Output file: No such file or directory\n");
+                free(pbpaths);
+                free(users);
                 fclose(infile);
                 fclose(outfile);
                 return 1;
             }
             break;
+        case 'M':
+            // write latency metrics at the end
+            metricspath = optarg;
+            break;
+        case 'T':
+            // latency counted as slow, in microseconds
+            threshold = (uint64_t) strtoull(optarg, NULL, 10);
+            break;
+        case 'U':
+            // asynchronous file I/O
+            chosen = insert_set(URING, chosen);
+            break;
+        case 'B':
+            // blocks per pipeline batch
+            batch = (size_t) strtoull(optarg, NULL, 10);
+            chosen = insert_set(BATCH, chosen);
+            break;
+        case 'Q':
+            // batches per pipeline queue
+            depth = (size_t) strtoull(optarg, NULL, 10);
+            chosen = insert_set(DEPTH, chosen);
+            break;
+        case 'W':
+            // compute workers
+            workers = (size_t) strtoull(optarg, NULL, 10);
+            chosen = insert_set(WORKERS, chosen);
+            break;
+        case 'A':
+            // tune for this host and key size
+            chosen = insert_set(AUTOTUNE, chosen);
+            break;
         default:
             message();
+            free(pbpaths);
+            free(users);
             fclose(infile);
             fclose(outfile);
             return 0;
         }
     }
 
-    // Open the public file
-    pbfile = fopen(pbpath, "r");
-    if (pbfile == NULL) {
-        fprintf(stderr, "rsa.pub: No such file or directory\n");
-        fclose(infile);
-        fclose(outfile);
-        return 1;
+    if (count == 0 && ucount == 0) {
+        pbpaths[count] = pbpath;
+        count += 1;
     }
 
-    // initialize the mpz variables
-    mpz_t n, e, s, name;
-    mpz_inits(n, e, s, name, NULL);
-
-    // make an array for the username
-    char username[_POSIX_LOGIN_NAME_MAX];
+    // read and verify every recipient's key, from files and then the keyring
+    Keyring *ring = NULL;
+    if (ucount > 0 && (ring = keyring_open(ringpath)) == NULL) {
+        fprintf(stderr, "%s: not a keyring\n", ringpath);
+    }
+    uint32_t files = count;
+    count += ucount;
+    mpz_t *n = (mpz_t *) calloc(count, sizeof(mpz_t));
+    mpz_t *e = (mpz_t *) calloc(count, sizeof(mpz_t));
+    bool valid = ucount == 0 || ring != NULL;
+    for (uint32_t i = 0; i < count; i += 1) {
+        mpz_inits(n[i], e[i], NULL);
+        if (i < files) {
+            valid = valid && load_key(pbpaths[i], n[i], e[i], chosen);
+        } else {
+            valid = valid && find_key(ring, users[i - files], n[i], e[i], chosen);
+        }
+    }
+    keyring_close(&ring);
 
-    // read the public file
-    rsa_read_pub(n, e, s, username, pbfile);
+    // tune for this host and key size if asked to, or use what was tuned before;
+    // pipeline settings given on the command line win
+    Profile profile;
+    uint64_t bits = mpz_sizeinbase(n[0], 2);
+    bool tuned = false;
+    if (valid && member_set(AUTOTUNE, chosen)) {
+        autotune_run(&profile, e[0], n[0], true);
+        tuned = true;
+        if (!autotune_save(&profile, "encrypt", bits)) {
+            fprintf(stderr, "autotune: couldn't save the profile\n");
+        }
+    } else if (valid && autotune_load(&profile, "encrypt", bits)) {
+        autotune_apply(&profile);
+        tuned = true;
+    }
+    if (tuned) {
+        batch = member_set(BATCH, chosen) ? batch : profile.batch;
+        depth = member_set(DEPTH, chosen) ? depth : profile.depth;
+        workers = member_set(WORKERS, chosen) ? workers : profile.workers;
+        if (member_set(VERBOSE, chosen)) {
+            profile.batch = batch;
+            profile.depth = depth;
+            profile.workers = workers;
+            autotune_print(&profile, member_set(AUTOTUNE, chosen) ? "tuned" : "cached");
+        }
+    }
+    pipeline_set(batch, depth, workers);
 
-    // if verbose printing was chosen, print the needed values
-    if (member_set(VERBOSE, chosen)) {
-        gmp_printf("user = %s\n", username); // username
-        gmp_printf("s (%d bits) = %Zd\n", mpz_sizeinbase(s, 2), s); // signature
-        gmp_printf("n (%d bits) = %Zd\n", mpz_sizeinbase(n, 2), n); // public modulus n
-        gmp_printf("e (%d bits) = %Zd\n", mpz_sizeinbase(e, 2), e); // public exponent e
+    // time every block if asked to, after tuning so none of its blocks count
+    if (metricspath != NULL) {
+        metrics = metrics_create(threshold * 1000);
     }
 
-    // convert the username that was read in to an mpz type variable
-    mpz_set_str(name, username, 62);
+    // keep reads and writes in flight while the blocks are computed, if asked to
+    if (member_set(URING, chosen)) {
+        FILE *in = uring_open(infile, "r");
+        FILE *out = uring_open(outfile, "w");
+        if (member_set(VERBOSE, chosen)) {
+            fprintf(stderr, "io_uring: input %s, output %s\n", (in != infile) ? "on" : "off (stdio)",
+                (out != outfile) ? "on" : "off (stdio)");
+        }
+        infile = in;
+        outfile = out;
+    }
 
-    // verify signature and enrypt the file
-    if (rsa_verify(name, s, e, n)) {
-        rsa_encrypt_file(infile, outfile, n, e);
-    } else {
-        fprintf(stderr, "Error: invalid key.\n");
+    // encrypt the file, in the plain format for one recipient
+    int status = valid ? 0 : 1;
+    bool compress = member_set(COMPRESS, chosen);
+    if (valid && count == 1 && compress) {
+        // compressed blocks get a header line, unless compression didn't pay off
+        LZReader *lz = lz_reader_create(infile);
+        if (lz_reader_worthwhile(lz)) {
+            fprintf(outfile, "%s %d\n", LZ_MAGIC, LZ_VERSION);
+        } else {
+            lz_reader_passthrough(lz);
+        }
+        rsa_encrypt_source(lz_read, lz, outfile, n[0], e[0]);
+        lz_reader_delete(&lz);
+    } else if (valid && count == 1) {
+        rsa_encrypt_file(infile, outfile, n[0], e[0]);
+    } else if (valid) {
+        switch (envelope_encrypt_file(infile, outfile, compress, count, n, e)) {
+        case ENVELOPE_NO_RANDOM:
+            fprintf(stderr, "Error: couldn't make a data key.\n");
+            status = 1;
+            break;
+        case ENVELOPE_SMALL_KEY:
+            fprintf(stderr, "Error: a recipient's key is under 17 bits, too small to encrypt for.\n");
+            status = 1;
+            break;
+        default: break;
+        }
+    }
+    if (metrics != NULL) {
+        if (valid && !metrics_write(metrics, metricspath)) {
+            fprintf(stderr, "%s: couldn't write metrics\n", metricspath);
+            status = 1;
+        }
+        metrics_delete(&metrics);
     }
 
     // clear all variables and close all files
-    mpz_clears(n, e, s, name, NULL);
-    fclose(pbfile);
+    for (uint32_t i = 0; i < count; i += 1) {
+        mpz_clears(n[i], e[i], NULL);
+    }
+    free(n);
+    free(e);
+    free(pbpaths);
+    free(users);
     fclose(infile);
-    fclose(outfile);
-    return 0;
+    if (fclose(outfile) != 0) {
+        fprintf(stderr, "Error: couldn't write the output.\n");
+        status = 1;
+    }
+    return status;
 }
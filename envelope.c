@@ -0,0 +1,345 @@
+// Multi-recipient ("envelope") encryption. The payload is encrypted once with
+// ChaCha20 under a random data key, and only the data key is RSA encrypted, once
+// for each recipient. The file is a text header followed by the binary payload:
+//
+//   RSAMULTI <version> <flags> <count>
+//   <fingerprint> <blocks>     one slot per recipient, the fingerprint is
+//   <block>                    rsa_fingerprint() of their n in hex, and each
+//   ...                        block is rsa_encrypt_file() style hex
+//   <payload bytes>            an lz.h stream if flags has ENVELOPE_COMPRESSED
+//   <mac>                      32 bytes of HMAC-SHA256
+//
+// The MAC is keyed with a hash of the wrapped secret, so only a recipient can
+// check it, and covers a hash of the header and every slot as well as the
+// encrypted payload, so neither can be changed, swapped or cut short. Decrypting
+// copies the encrypted payload to a temporary file while checking the MAC and
+// only decrypts it once the MAC matches, so nothing is written for a forged file.
+// Version 1 files had no MAC and are refused.
+#include "envelope.h"
+#include "chacha20.h"
+#include "lz.h"
+#include "randstate.h"
+#include "rsa.h"
+#include "sha256.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SECRET  (CHACHA20_KEY + CHACHA20_NONCE) // bytes wrapped for each recipient
+#define PAYLOAD (64 * 1024) // bytes encrypted per read
+#define MAC     SHA256_DIGEST
+
+// The most blocks a slot can take: wrap() needs keys of at least 17 bits, which
+// carry k - 1 = 1 byte of the secret per block
+#define MAX_BLOCKS SECRET
+
+// The mac_init() function starts the MAC of a file, under a key derived from
+// the secret so it differs from the ChaCha20 key
+// Inputs: the MAC, the secret and the digest of the header and slots
+// Outputs: void
+
+static void mac_init(HMACSHA256 *mac, const uint8_t secret[SECRET], const uint8_t head[SHA256_DIGEST]) {
+    static const char label[] = "RSAMULTI MAC";
+    uint8_t key[SHA256_DIGEST];
+    SHA256 ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, label, sizeof(label));
+    sha256_update(&ctx, secret, SECRET);
+    sha256_final(&ctx, key);
+    hmac_sha256_init(mac, key, sizeof(key));
+    hmac_sha256_update(mac, head, SHA256_DIGEST);
+    memset(key, 0, sizeof(key));
+    memset(&ctx, 0, sizeof(ctx));
+    return;
+}
+
+// The head_mpz() function adds one slot block to the hash of the header, in hex
+// the same way whatever case or layout the file used
+// Inputs: the hash and the block
+// Outputs: void
+
+static void head_mpz(SHA256 *head, mpz_t x) {
+    char *text = mpz_get_str(NULL, 16, x);
+    sha256_update(head, text, strlen(text));
+    sha256_update(head, "\n", 1);
+    free(text);
+    return;
+}
+
+// The wrap() function writes one recipient's slot: the fingerprint of their key
+// and the secret split into RSA blocks the same way rsa_encrypt_file() does it
+// Inputs: the writer, the hash of the header, the secret, n = public modulus,
+// e = public exponent
+// Outputs: void
+
+static void wrap(HexWriter *w, SHA256 *head, const uint8_t secret[SECRET], mpz_t n, mpz_t e) {
+    uint64_t k = (mpz_sizeinbase(n, 2) - 1) / 8;
+    uint64_t blocks = (SECRET + k - 2) / (k - 1);
+
+    uint8_t fp[SHA256_DIGEST];
+    char line[2 * SHA256_DIGEST + 32];
+    rsa_fingerprint(fp, n);
+    size_t len = hex_encode(line, fp, SHA256_DIGEST);
+    snprintf(line + len, sizeof(line) - len, " %lu\n", (unsigned long) blocks);
+    hex_write_str(w, line);
+    sha256_update(head, line, strlen(line));
+
+    uint8_t *array = (uint8_t *) calloc(k, sizeof(uint8_t));
+    array[0] = 0xFF;
+    mpz_t m, c;
+    mpz_inits(m, c, NULL);
+    for (uint64_t i = 0; i < SECRET; i += k - 1) {
+        uint64_t j = (SECRET - i < k - 1) ? SECRET - i : k - 1;
+        memcpy(array + 1, secret + i, j);
+        mpz_import(m, j + 1, 1, sizeof(uint8_t), 1, 0, array);
+        rsa_encrypt(c, m, e, n);
+        hex_write_mpz(w, c);
+        head_mpz(head, c);
+    }
+    mpz_clears(m, c, NULL);
+    free(array);
+    return;
+}
+
+// The unwrap() function decrypts the blocks of our slot back into the secret
+// Inputs: the reader, the hash of the header, the number of blocks,
+// secret = output, n = public modulus, d = private key
+// Outputs: true if the blocks decrypted to exactly one secret
+
+static bool unwrap(HexReader *r, SHA256 *head, uint64_t blocks, uint8_t secret[SECRET], mpz_t n, mpz_t d) {
+    uint8_t *array = (uint8_t *) calloc((mpz_sizeinbase(n, 2) + 7) / 8, sizeof(uint8_t));
+    mpz_t c, m;
+    mpz_inits(c, m, NULL);
+
+    size_t have = 0;
+    bool ok = true;
+    for (uint64_t i = 0; i < blocks && ok; i += 1) {
+        size_t j = 0;
+        ok = hex_read_mpz(r, c);
+        if (ok) {
+            head_mpz(head, c);
+            rsa_decrypt(m, c, d, n);
+            mpz_export(array, &j, 1, sizeof(uint8_t), 1, 0, m);
+            ok = j > 0 && array[0] == 0xFF && have + j - 1 <= SECRET;
+        }
+        if (ok) {
+            memcpy(secret + have, array + 1, j - 1);
+            have += j - 1;
+        }
+    }
+
+    mpz_clears(c, m, NULL);
+    free(array);
+    return ok && have == SECRET;
+}
+
+// The envelope_encrypt_file() function reads infile once and encrypts it for
+// every recipient
+// Inputs: the input and output files, whether to try compressing the payload,
+// the number of recipients, and their public moduli n and exponents e
+// Outputs: ENVELOPE_OK, or why nothing was written
+
+EnvelopeStatus envelope_encrypt_file(FILE *infile, FILE *outfile, bool compress, uint32_t count, mpz_t n[], mpz_t e[]) {
+    // wrap() puts k - 1 bytes of the secret in each block of a k + 1 byte modulus
+    for (uint32_t i = 0; i < count; i += 1) {
+        if ((mpz_sizeinbase(n[i], 2) - 1) / 8 < 2) {
+            return ENVELOPE_SMALL_KEY;
+        }
+    }
+    uint8_t secret[SECRET];
+    if (!random_bytes(secret, SECRET)) {
+        return ENVELOPE_NO_RANDOM;
+    }
+
+    // only compress if the start of the input shows that it helps
+    ByteSource source = rsa_file_source;
+    void *ctx = infile;
+    LZReader *lz = NULL;
+    int flags = 0;
+    if (compress) {
+        lz = lz_reader_create(infile);
+        if (lz_reader_worthwhile(lz)) {
+            flags |= ENVELOPE_COMPRESSED;
+        } else {
+            lz_reader_passthrough(lz);
+        }
+        source = lz_read;
+        ctx = lz;
+    }
+
+    HexWriter *w = hex_writer_create(outfile);
+    SHA256 head;
+    uint8_t digest[SHA256_DIGEST];
+    char line[64];
+    snprintf(line, sizeof(line), "%s %d %d %u\n", ENVELOPE_MAGIC, ENVELOPE_VERSION, flags, count);
+    hex_write_str(w, line);
+    sha256_init(&head);
+    sha256_update(&head, line, strlen(line));
+    for (uint32_t i = 0; i < count; i += 1) {
+        wrap(w, &head, secret, n[i], e[i]);
+    }
+    hex_writer_delete(&w);
+    sha256_final(&head, digest);
+
+    // encrypt, then MAC what was encrypted
+    ChaCha20 cipher;
+    HMACSHA256 mac;
+    chacha20_init(&cipher, secret, secret + CHACHA20_KEY);
+    mac_init(&mac, secret, digest);
+    uint8_t *buf = (uint8_t *) malloc(PAYLOAD);
+    size_t j;
+    while ((j = source(ctx, buf, PAYLOAD)) > 0) {
+        chacha20_xor(&cipher, buf, j);
+        hmac_sha256_update(&mac, buf, j);
+        fwrite(buf, sizeof(uint8_t), j, outfile);
+    }
+    hmac_sha256_final(&mac, digest);
+    fwrite(digest, sizeof(uint8_t), MAC, outfile);
+
+    if (lz != NULL) {
+        lz_reader_delete(&lz);
+    }
+    free(buf);
+    memset(secret, 0, SECRET);
+    memset(&cipher, 0, sizeof(cipher));
+    return ENVELOPE_OK;
+}
+
+// The spool() function copies the encrypted payload to a temporary file and
+// checks its MAC on the way, holding back the last MAC bytes read since the
+// payload ends where the MAC starts
+// Inputs: the reader, the MAC so far, the temporary file
+// Outputs: true if the MAC at the end matches
+
+static bool spool(HexReader *r, HMACSHA256 *mac, FILE *tmp) {
+    uint8_t *buf = (uint8_t *) malloc(PAYLOAD + MAC);
+    size_t have = 0;
+    size_t j;
+    while ((j = hex_read_raw(r, buf + have, PAYLOAD)) > 0) {
+        have += j;
+        if (have > MAC) {
+            hmac_sha256_update(mac, buf, have - MAC);
+            fwrite(buf, sizeof(uint8_t), have - MAC, tmp);
+            memmove(buf, buf + have - MAC, MAC);
+            have = MAC;
+        }
+    }
+    uint8_t expect[MAC];
+    hmac_sha256_final(mac, expect);
+    // compare every byte, so the time taken doesn't show where they differ
+    uint8_t diff = (have == MAC) ? 0 : 1;
+    for (size_t i = 0; i < MAC; i += 1) {
+        diff |= (uint8_t) (expect[i] ^ ((i < have) ? buf[i] : 0));
+    }
+    free(buf);
+    return diff == 0 && fflush(tmp) == 0 && !ferror(tmp);
+}
+
+// The envelope_decrypt_file() function finds the slot for our key by its
+// fingerprint, recovers the data key, checks the MAC and only then decrypts the
+// payload
+// Inputs: a reader positioned just after the header line, the header line,
+// the output file, n = public modulus, d = private key
+// Outputs: ENVELOPE_OK, or why nothing was decrypted
+
+EnvelopeStatus envelope_decrypt_file(HexReader *r, const char *header, FILE *outfile, mpz_t n, mpz_t d) {
+    char line[2 * SHA256_DIGEST + 32];
+    char magic[16];
+    unsigned version, flags, count;
+    if (sscanf(header, "%15s %u %u %u", magic, &version, &flags, &count) != 4
+        || strcmp(magic, ENVELOPE_MAGIC) != 0 || version != ENVELOPE_VERSION) {
+        return ENVELOPE_MALFORMED;
+    }
+
+    // the header and slots are hashed as the encryptor wrote them
+    SHA256 head;
+    uint8_t digest[SHA256_DIGEST];
+    sha256_init(&head);
+    snprintf(line, sizeof(line), "%s %u %u %u\n", magic, version, flags, count);
+    sha256_update(&head, line, strlen(line));
+
+    uint8_t fp[SHA256_DIGEST];
+    char mine[2 * SHA256_DIGEST + 1];
+    rsa_fingerprint(fp, n);
+    mine[hex_encode(mine, fp, SHA256_DIGEST)] = '\0';
+
+    uint8_t secret[SECRET];
+    bool found = false;
+    mpz_t skip;
+    mpz_init(skip);
+    for (unsigned i = 0; i < count; i += 1) {
+        char slot[2 * SHA256_DIGEST + 1];
+        unsigned long blocks;
+        if (!hex_read_line(r, line, sizeof(line)) || sscanf(line, "%64s %lu", slot, &blocks) != 2) {
+            mpz_clear(skip);
+            return ENVELOPE_MALFORMED;
+        }
+        if (blocks > MAX_BLOCKS) {
+            mpz_clear(skip);
+            return ENVELOPE_MALFORMED;
+        }
+        snprintf(line, sizeof(line), "%s %lu\n", slot, blocks);
+        sha256_update(&head, line, strlen(line));
+        if (!found && strcmp(slot, mine) == 0) {
+            // our slot must decrypt, or the reader is left partway through it
+            if (!unwrap(r, &head, blocks, secret, n, d)) {
+                mpz_clear(skip);
+                memset(secret, 0, SECRET);
+                return ENVELOPE_FORGED;
+            }
+            found = true;
+            continue;
+        }
+        for (unsigned long b = 0; b < blocks; b += 1) {
+            if (!hex_read_mpz(r, skip)) {
+                mpz_clear(skip);
+                return ENVELOPE_MALFORMED;
+            }
+            head_mpz(&head, skip);
+        }
+    }
+    mpz_clear(skip);
+    sha256_final(&head, digest);
+    if (!found) {
+        return ENVELOPE_NO_SLOT;
+    }
+
+    FILE *tmp = tmpfile();
+    if (tmp == NULL) {
+        memset(secret, 0, SECRET);
+        return ENVELOPE_NO_SPOOL;
+    }
+    HMACSHA256 mac;
+    mac_init(&mac, secret, digest);
+    if (!spool(r, &mac, tmp)) {
+        fclose(tmp);
+        memset(secret, 0, SECRET);
+        return ENVELOPE_FORGED;
+    }
+    rewind(tmp);
+
+    ByteSink sink = rsa_file_sink;
+    void *ctx = outfile;
+    LZWriter *lz = NULL;
+    if (flags & ENVELOPE_COMPRESSED) {
+        lz = lz_writer_create(outfile);
+        sink = lz_write;
+        ctx = lz;
+    }
+
+    ChaCha20 cipher;
+    chacha20_init(&cipher, secret, secret + CHACHA20_KEY);
+    uint8_t *buf = (uint8_t *) malloc(PAYLOAD);
+    size_t j;
+    while ((j = fread(buf, sizeof(uint8_t), PAYLOAD, tmp)) > 0) {
+        chacha20_xor(&cipher, buf, j);
+        sink(ctx, buf, j);
+    }
+
+    bool ok = (lz == NULL) || lz_writer_delete(&lz);
+    fclose(tmp);
+    free(buf);
+    memset(secret, 0, SECRET);
+    memset(&cipher, 0, sizeof(cipher));
+    return ok ? ENVELOPE_OK : ENVELOPE_CORRUPT;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "hex.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <gmp.h>
+
+#define ENVELOPE_MAGIC   "RSAMULTI" // first word of a multi-recipient file
+#define ENVELOPE_VERSION 2
+
+#define ENVELOPE_COMPRESSED 1 // header flag: the payload is an lz.h stream
+
+// Why envelope_decrypt_file() didn't decrypt a file
+typedef enum {
+    ENVELOPE_OK,
+    ENVELOPE_MALFORMED, // not a header or version we read
+    ENVELOPE_NO_SLOT, // no slot for this key, or it didn't decrypt
+    ENVELOPE_FORGED, // the MAC doesn't match: modified or truncated
+    ENVELOPE_NO_SPOOL, // no temporary file to hold the payload while checking it
+    ENVELOPE_CORRUPT, // authentic, but the compressed payload doesn't decompress
+    ENVELOPE_NO_RANDOM, // no random data key could be made
+    ENVELOPE_SMALL_KEY, // a recipient's modulus is under 17 bits, too small to wrap for
+} EnvelopeStatus;
+
+EnvelopeStatus envelope_encrypt_file(FILE *infile, FILE *outfile, bool compress, uint32_t count, mpz_t n[], mpz_t e[]);
+
+EnvelopeStatus envelope_decrypt_file(HexReader *r, const char *header, FILE *outfile, mpz_t n, mpz_t d);
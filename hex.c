@@ -0,0 +1,595 @@
+#include "hex.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HEX_X86 1
+#include <immintrin.h>
+#endif
+
+#define HEX_BUFFER (64 * 1024) // initial size of the reader and writer buffers
+
+static const char digits[] = "0123456789abcdef";
+
+// The encode_scalar() function converts bytes into lowercase hex one byte at a time
+// Inputs: hex = output characters (2 * len of them), bytes = input, len = number of bytes
+// Outputs: void
+
+static void encode_scalar(char *hex, const uint8_t *bytes, size_t len) {
+    for (size_t i = 0; i < len; i += 1) {
+        hex[2 * i] = digits[bytes[i] >> 4];
+        hex[2 * i + 1] = digits[bytes[i] & 0x0F];
+    }
+    return;
+}
+
+// The nibble() function returns the value of a hex digit, or -1 if it isn't one
+// Inputs: c = the character
+// Outputs: 0 to 15, or -1
+
+static inline int nibble(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c |= 0x20; // fold 'A'-'F' onto 'a'-'f'
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+// The decode_scalar() function converts pairs of hex digits into bytes one at a time
+// Inputs: bytes = output, hex = input characters (2 * len of them), len = number of bytes
+// Outputs: true if every character was a hex digit, false otherwise
+
+static bool decode_scalar(uint8_t *bytes, const char *hex, size_t len) {
+    for (size_t i = 0; i < len; i += 1) {
+        int hi = nibble(hex[2 * i]);
+        int lo = nibble(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0) {
+            return false;
+        }
+        bytes[i] = (uint8_t) ((hi << 4) | lo);
+    }
+    return true;
+}
+
+#ifdef HEX_X86
+
+// The encode_sse2() function converts 16 bytes into 32 hex characters per step.
+// Each byte is widened to a 16 bit lane holding (high nibble, low nibble), and the
+// nibbles are turned into ASCII with a compare instead of a table lookup.
+// Inputs: hex = output characters, bytes = input, len = number of bytes
+// Outputs: void
+
+__attribute__((target("sse2"))) static void encode_sse2(char *hex, const uint8_t *bytes, size_t len) {
+    const __m128i low = _mm_set1_epi16(0x000F);
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i gap = _mm_set1_epi8('a' - '0' - 10);
+    const __m128i none = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i b = _mm_loadu_si128((const __m128i *) (bytes + i));
+        __m128i half[2] = { _mm_unpacklo_epi8(b, none), _mm_unpackhi_epi8(b, none) };
+        for (int h = 0; h < 2; h += 1) {
+            __m128i hi = _mm_and_si128(_mm_srli_epi16(half[h], 4), low);
+            __m128i lo = _mm_slli_epi16(_mm_and_si128(half[h], low), 8);
+            __m128i n = _mm_or_si128(hi, lo);
+            __m128i c = _mm_add_epi8(n, zero);
+            c = _mm_add_epi8(c, _mm_and_si128(_mm_cmpgt_epi8(n, nine), gap));
+            _mm_storeu_si128((__m128i *) (hex + 2 * i + 16 * h), c);
+        }
+    }
+    encode_scalar(hex + 2 * i, bytes + i, len - i);
+    return;
+}
+
+// The decode_sse2() function converts 32 hex characters into 16 bytes per step.
+// Inputs: bytes = output, hex = input characters, len = number of bytes
+// Outputs: true if every character was a hex digit, false otherwise
+
+__attribute__((target("sse2"))) static bool decode_sse2(uint8_t *bytes, const char *hex, size_t len) {
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i five = _mm_set1_epi8(5);
+    const __m128i ten = _mm_set1_epi8(10);
+    const __m128i fold = _mm_set1_epi8(0x20);
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i alpha = _mm_set1_epi8('a' - 10);
+    const __m128i low = _mm_set1_epi16(0x00FF);
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i t[2];
+        for (int h = 0; h < 2; h += 1) {
+            __m128i v = _mm_loadu_si128((const __m128i *) (hex + 2 * i + 16 * h));
+            __m128i d = _mm_sub_epi8(v, zero);
+            __m128i a = _mm_sub_epi8(_mm_or_si128(v, fold), alpha);
+            __m128i is_d = _mm_cmpeq_epi8(_mm_min_epu8(d, nine), d);
+            __m128i ta = _mm_sub_epi8(a, ten);
+            __m128i is_a = _mm_cmpeq_epi8(_mm_min_epu8(ta, five), ta);
+            if (_mm_movemask_epi8(_mm_or_si128(is_d, is_a)) != 0xFFFF) {
+                return false;
+            }
+            __m128i n = _mm_or_si128(_mm_and_si128(d, is_d), _mm_and_si128(a, is_a));
+            // each 16 bit lane is (first digit, second digit), so byte = first << 4 | second
+            t[h] = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(n, low), 4), _mm_srli_epi16(n, 8));
+        }
+        _mm_storeu_si128((__m128i *) (bytes + i), _mm_packus_epi16(t[0], t[1]));
+    }
+    return decode_scalar(bytes + i, hex + 2 * i, len - i);
+}
+
+// The encode_avx2() function is encode_sse2() with 32 bytes per step
+// Inputs: hex = output characters, bytes = input, len = number of bytes
+// Outputs: void
+
+__attribute__((target("avx2"))) static void encode_avx2(char *hex, const uint8_t *bytes, size_t len) {
+    const __m256i low = _mm256_set1_epi16(0x000F);
+    const __m256i nine = _mm256_set1_epi8(9);
+    const __m256i zero = _mm256_set1_epi8('0');
+    const __m256i gap = _mm256_set1_epi8('a' - '0' - 10);
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        for (int h = 0; h < 2; h += 1) {
+            __m256i w = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (bytes + i + 16 * h)));
+            __m256i hi = _mm256_and_si256(_mm256_srli_epi16(w, 4), low);
+            __m256i lo = _mm256_slli_epi16(_mm256_and_si256(w, low), 8);
+            __m256i n = _mm256_or_si256(hi, lo);
+            __m256i c = _mm256_add_epi8(n, zero);
+            c = _mm256_add_epi8(c, _mm256_and_si256(_mm256_cmpgt_epi8(n, nine), gap));
+            _mm256_storeu_si256((__m256i *) (hex + 2 * i + 32 * h), c);
+        }
+    }
+    encode_sse2(hex + 2 * i, bytes + i, len - i);
+    return;
+}
+
+// The decode_avx2() function is decode_sse2() with 32 bytes per step
+// Inputs: bytes = output, hex = input characters, len = number of bytes
+// Outputs: true if every character was a hex digit, false otherwise
+
+__attribute__((target("avx2"))) static bool decode_avx2(uint8_t *bytes, const char *hex, size_t len) {
+    const __m256i nine = _mm256_set1_epi8(9);
+    const __m256i five = _mm256_set1_epi8(5);
+    const __m256i ten = _mm256_set1_epi8(10);
+    const __m256i fold = _mm256_set1_epi8(0x20);
+    const __m256i zero = _mm256_set1_epi8('0');
+    const __m256i alpha = _mm256_set1_epi8('a' - 10);
+    const __m256i low = _mm256_set1_epi16(0x00FF);
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i t[2];
+        for (int h = 0; h < 2; h += 1) {
+            __m256i v = _mm256_loadu_si256((const __m256i *) (hex + 2 * i + 32 * h));
+            __m256i d = _mm256_sub_epi8(v, zero);
+            __m256i a = _mm256_sub_epi8(_mm256_or_si256(v, fold), alpha);
+            __m256i is_d = _mm256_cmpeq_epi8(_mm256_min_epu8(d, nine), d);
+            __m256i ta = _mm256_sub_epi8(a, ten);
+            __m256i is_a = _mm256_cmpeq_epi8(_mm256_min_epu8(ta, five), ta);
+            if (_mm256_movemask_epi8(_mm256_or_si256(is_d, is_a)) != -1) {
+                return false;
+            }
+            __m256i n = _mm256_or_si256(_mm256_and_si256(d, is_d), _mm256_and_si256(a, is_a));
+            t[h] = _mm256_or_si256(
+                _mm256_slli_epi16(_mm256_and_si256(n, low), 4), _mm256_srli_epi16(n, 8));
+        }
+        // packus works within 128 bit lanes, so put the quarters back in order
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(t[0], t[1]), 0xD8);
+        _mm256_storeu_si256((__m256i *) (bytes + i), packed);
+    }
+    return decode_sse2(bytes + i, hex + 2 * i, len - i);
+}
+
+#endif
+
+// The kernel in use, picked once from what the CPU supports
+static void (*encode_kernel)(char *, const uint8_t *, size_t) = NULL;
+static bool (*decode_kernel)(uint8_t *, const char *, size_t) = NULL;
+static const char *kernel_name = "scalar";
+
+// The pick_kernel() function chooses the widest encoder and decoder the CPU runs
+// Inputs: void
+// Outputs: void
+
+static void pick_kernel(void) {
+    encode_kernel = encode_scalar;
+    decode_kernel = decode_scalar;
+#ifdef HEX_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        encode_kernel = encode_avx2;
+        decode_kernel = decode_avx2;
+        kernel_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        encode_kernel = encode_sse2;
+        decode_kernel = decode_sse2;
+        kernel_name = "sse2";
+    }
+#endif
+    return;
+}
+
+// The hex_set_kernel() function uses the named encoder and decoder instead of
+// the widest one
+// Inputs: "scalar", "sse2" or "avx2"
+// Outputs: true if the CPU runs that kernel
+
+bool hex_set_kernel(const char *name) {
+    if (strcmp(name, "scalar") == 0) {
+        encode_kernel = encode_scalar;
+        decode_kernel = decode_scalar;
+        kernel_name = "scalar";
+        return true;
+    }
+#ifdef HEX_X86
+    __builtin_cpu_init();
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        encode_kernel = encode_avx2;
+        decode_kernel = decode_avx2;
+        kernel_name = "avx2";
+        return true;
+    } else if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+        encode_kernel = encode_sse2;
+        decode_kernel = decode_sse2;
+        kernel_name = "sse2";
+        return true;
+    }
+#endif
+    return false;
+}
+
+// The hex_encode() function converts bytes into lowercase hex digits
+// Inputs: hex = output, must hold 2 * len characters (not NUL terminated),
+// bytes = input, len = number of bytes
+// Outputs: the number of characters written
+
+size_t hex_encode(char *hex, const uint8_t *bytes, size_t len) {
+    if (encode_kernel == NULL) {
+        pick_kernel();
+    }
+    encode_kernel(hex, bytes, len);
+    return 2 * len;
+}
+
+// The hex_decode() function converts 2 * len hex digits (either case) into bytes
+// Inputs: bytes = output, hex = input, len = number of bytes to produce
+// Outputs: true if every character was a hex digit, false otherwise
+
+bool hex_decode(uint8_t *bytes, const char *hex, size_t len) {
+    if (decode_kernel == NULL) {
+        pick_kernel();
+    }
+    return decode_kernel(bytes, hex, len);
+}
+
+// The hex_kernel() function names the encoder/decoder in use
+// Inputs: void
+// Outputs: "scalar", "sse2" or "avx2"
+
+const char *hex_kernel(void) {
+    if (encode_kernel == NULL) {
+        pick_kernel();
+    }
+    return kernel_name;
+}
+
+struct HexReader {
+    FILE *infile;
+    char *buf; // buffered input, valid from pos to len
+    size_t size;
+    size_t pos;
+    size_t len;
+    bool eof;
+    bool failed;
+    uint8_t *bytes; // scratch space for decoded numbers
+    size_t bytes_size;
+};
+
+// The hex_reader_create() function makes a buffered reader for hex numbers, one per line
+// Inputs: the input file
+// Outputs: the new reader
+
+HexReader *hex_reader_create(FILE *infile) {
+    HexReader *r = (HexReader *) calloc(1, sizeof(HexReader));
+    r->infile = infile;
+    r->size = HEX_BUFFER;
+    r->buf = (char *) malloc(r->size);
+    return r;
+}
+
+// The hex_reader_delete() function frees a reader. Unread buffered input is lost.
+// Inputs: the reader
+// Outputs: void
+
+void hex_reader_delete(HexReader **r) {
+    free((*r)->buf);
+    free((*r)->bytes);
+    free(*r);
+    *r = NULL;
+    return;
+}
+
+// The refill() function moves unread input to the front of the buffer and reads
+// as much more as fits, doubling the buffer first if it is already full
+// Inputs: the reader
+// Outputs: true if anything was read, false at end of file
+
+static bool refill(HexReader *r) {
+    if (r->eof) {
+        return false;
+    }
+    if (r->pos > 0) {
+        memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+        r->len -= r->pos;
+        r->pos = 0;
+    }
+    if (r->len == r->size) {
+        r->size *= 2;
+        r->buf = (char *) realloc(r->buf, r->size);
+    }
+    size_t j = fread(r->buf + r->len, sizeof(char), r->size - r->len, r->infile);
+    if (j == 0) {
+        r->eof = true;
+        return false;
+    }
+    r->len += j;
+    return true;
+}
+
+// The next_line() function finds the next non-blank line, skipping leading and
+// trailing whitespace the same way gmp_fscanf() did
+// Inputs: the reader, and where to put the start and length of the line
+// Outputs: true if there was a line, false at end of file
+
+static bool next_line(HexReader *r, char **start, size_t *length) {
+    while (true) {
+        while (r->pos < r->len && isspace((unsigned char) r->buf[r->pos])) {
+            r->pos += 1;
+        }
+        if (r->pos == r->len) {
+            if (!refill(r)) {
+                return false;
+            }
+            continue;
+        }
+        char *nl = memchr(r->buf + r->pos, '\n', r->len - r->pos);
+        if (nl == NULL && refill(r)) {
+            continue; // line goes past the buffered input
+        }
+        *start = r->buf + r->pos;
+        *length = (nl == NULL) ? r->len - r->pos : (size_t) (nl - *start);
+        r->pos += *length + (nl != NULL); // the newline is consumed too
+        while (*length > 0 && isspace((unsigned char) (*start)[*length - 1])) {
+            *length -= 1;
+        }
+        return true;
+    }
+}
+
+// The hex_read_mpz() function reads the next line as a hex number
+// Inputs: the reader and x = output carrying variable
+// Outputs: true if a number was read, false at end of file or on a malformed line
+
+bool hex_read_mpz(HexReader *r, mpz_t x) {
+    char *line;
+    size_t length;
+    if (r->failed || !next_line(r, &line, &length)) {
+        return false;
+    }
+
+    size_t count = (length + 1) / 2;
+    if (count > r->bytes_size) {
+        r->bytes_size = count;
+        r->bytes = (uint8_t *) realloc(r->bytes, count);
+    }
+
+    // an odd number of digits means the first byte only has a low nibble
+    size_t odd = length % 2;
+    if (odd) {
+        int lo = nibble(line[0]);
+        if (lo < 0) {
+            r->failed = true;
+            return false;
+        }
+        r->bytes[0] = (uint8_t) lo;
+    }
+    if (!hex_decode(r->bytes + odd, line + odd, length / 2)) {
+        r->failed = true;
+        return false;
+    }
+
+    mpz_import(x, count, 1, sizeof(uint8_t), 1, 0, r->bytes);
+    return true;
+}
+
+// The hex_read_token() function reads the first word of the next line, like %s
+// Inputs: the reader, token = output, size = space in token including the NUL
+// Outputs: true if a word was read, false at end of file
+
+bool hex_read_token(HexReader *r, char token[], size_t size) {
+    char *line;
+    size_t length;
+    if (size == 0 || !next_line(r, &line, &length)) {
+        return false;
+    }
+    size_t i = 0;
+    while (i < length && i + 1 < size && !isspace((unsigned char) line[i])) {
+        token[i] = line[i];
+        i += 1;
+    }
+    token[i] = '\0';
+    return true;
+}
+
+// The hex_read_line() function reads the next non-blank line, without the
+// surrounding whitespace
+// Inputs: the reader, line = output, size = space in line including the NUL
+// Outputs: true if a line was read, false at end of file or if it didn't fit
+
+bool hex_read_line(HexReader *r, char line[], size_t size) {
+    char *start;
+    size_t length;
+    if (!next_line(r, &start, &length) || length >= size) {
+        return false;
+    }
+    memcpy(line, start, length);
+    line[length] = '\0';
+    return true;
+}
+
+// The hex_peek() function looks at the next character that isn't whitespace
+// without consuming it
+// Inputs: the reader
+// Outputs: the character, or EOF at end of file
+
+int hex_peek(HexReader *r) {
+    while (true) {
+        while (r->pos < r->len && isspace((unsigned char) r->buf[r->pos])) {
+            r->pos += 1;
+        }
+        if (r->pos < r->len) {
+            return (unsigned char) r->buf[r->pos];
+        }
+        if (!refill(r)) {
+            return EOF;
+        }
+    }
+}
+
+// The hex_read_raw() function reads bytes that follow the last line read, first
+// from the buffer and then straight from the file
+// Inputs: the reader, buf = output, len = the most bytes to read
+// Outputs: the number of bytes read, 0 at end of file
+
+size_t hex_read_raw(HexReader *r, uint8_t *buf, size_t len) {
+    size_t have = r->len - r->pos;
+    if (have > 0) {
+        size_t take = (have < len) ? have : len;
+        memcpy(buf, r->buf + r->pos, take);
+        r->pos += take;
+        return take;
+    }
+    if (r->eof) {
+        return 0;
+    }
+    return fread(buf, sizeof(uint8_t), len, r->infile);
+}
+
+// The hex_reader_failed() function tells if reading stopped on a malformed line
+// Inputs: the reader
+// Outputs: true if a line wasn't valid hex
+
+bool hex_reader_failed(HexReader *r) {
+    return r->failed;
+}
+
+struct HexWriter {
+    FILE *outfile;
+    char *buf; // pending output, written out once full
+    size_t size;
+    size_t len;
+    uint8_t *bytes; // scratch space for exported numbers
+    size_t bytes_size;
+};
+
+// The hex_writer_create() function makes a buffered writer for hex numbers
+// Inputs: the output file
+// Outputs: the new writer
+
+HexWriter *hex_writer_create(FILE *outfile) {
+    HexWriter *w = (HexWriter *) calloc(1, sizeof(HexWriter));
+    w->outfile = outfile;
+    w->size = HEX_BUFFER;
+    w->buf = (char *) malloc(w->size);
+    return w;
+}
+
+// The hex_writer_delete() function flushes and frees a writer
+// Inputs: the writer
+// Outputs: void
+
+void hex_writer_delete(HexWriter **w) {
+    hex_writer_flush(*w);
+    free((*w)->buf);
+    free((*w)->bytes);
+    free(*w);
+    *w = NULL;
+    return;
+}
+
+// The hex_writer_flush() function writes out everything pending
+// Inputs: the writer
+// Outputs: void
+
+void hex_writer_flush(HexWriter *w) {
+    if (w->len > 0) {
+        fwrite(w->buf, sizeof(char), w->len, w->outfile);
+        w->len = 0;
+    }
+    return;
+}
+
+// The reserve() function makes room for need more characters of output
+// Inputs: the writer and the number of characters
+// Outputs: void
+
+static void reserve(HexWriter *w, size_t need) {
+    if (w->len + need > w->size) {
+        hex_writer_flush(w);
+    }
+    if (need > w->size) {
+        w->size = need;
+        w->buf = (char *) realloc(w->buf, w->size);
+    }
+    return;
+}
+
+// The hex_write_mpz() function writes x as lowercase hex followed by a newline,
+// exactly like gmp_fprintf("%Zx\n")
+// Inputs: the writer and the number
+// Outputs: void
+
+void hex_write_mpz(HexWriter *w, mpz_t x) {
+    size_t count = (mpz_sizeinbase(x, 2) + 7) / 8;
+    if (mpz_sgn(x) == 0) {
+        hex_write_str(w, "0\n");
+        return;
+    }
+    if (count > w->bytes_size) {
+        w->bytes_size = count;
+        w->bytes = (uint8_t *) realloc(w->bytes, count);
+    }
+    mpz_export(w->bytes, &count, 1, sizeof(uint8_t), 1, 0, x);
+
+    reserve(w, 2 * count + 1);
+    char *out = w->buf + w->len;
+
+    // no leading zero, so a first byte below 0x10 is a single digit
+    size_t skip = 0;
+    if (w->bytes[0] < 0x10) {
+        *out++ = digits[w->bytes[0]];
+        skip = 1;
+    }
+    out += hex_encode(out, w->bytes + skip, count - skip);
+    *out++ = '\n';
+    w->len = (size_t) (out - w->buf);
+    return;
+}
+
+// The hex_write_str() function writes a plain string
+// Inputs: the writer and the string
+// Outputs: void
+
+void hex_write_str(HexWriter *w, const char *s) {
+    size_t length = strlen(s);
+    reserve(w, length);
+    memcpy(w->buf + w->len, s, length);
+    w->len += length;
+    return;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <gmp.h>
+
+typedef struct HexReader HexReader;
+
+typedef struct HexWriter HexWriter;
+
+size_t hex_encode(char *hex, const uint8_t *bytes, size_t len);
+
+bool hex_decode(uint8_t *bytes, const char *hex, size_t len);
+
+const char *hex_kernel(void);
+
+bool hex_set_kernel(const char *name);
+
+HexReader *hex_reader_create(FILE *infile);
+
+void hex_reader_delete(HexReader **r);
+
+bool hex_read_mpz(HexReader *r, mpz_t x);
+
+bool hex_read_token(HexReader *r, char token[], size_t size);
+
+bool hex_read_line(HexReader *r, char line[], size_t size);
+
+int hex_peek(HexReader *r);
+
+size_t hex_read_raw(HexReader *r, uint8_t *buf, size_t len);
+
+bool hex_reader_failed(HexReader *r);
+
+HexWriter *hex_writer_create(FILE *outfile);
+
+void hex_writer_delete(HexWriter **w);
+
+void hex_write_mpz(HexWriter *w, mpz_t x);
+
+void hex_write_str(HexWriter *w, const char *s);
+
+void hex_writer_flush(HexWriter *w);
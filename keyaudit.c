@@ -0,0 +1,239 @@
+#include "batchgcd.h"
+#include "keyring.h"
+#include "rsa.h"
+#include "set.h"
+
+#include <stdio.h>
+#include <limits.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// This function prints out information about how to properly use the file
+// Inputs: void
+// Outputs: void
+
+void message(void) {
+    fprintf(stderr, "SYNOPSIS\n"
+                    "   Audits a collection of public keys for moduli that share a prime,\n"
+                    "   using batch GCD over a product tree and a remainder tree.\n"
+                    "\n"
+                    "USAGE\n"
+                    "   ./keyaudit [-hv] [-K keyring] [-l listfile] [-t threads] [-T tmpdir]\n"
+                    "              [-m megabytes] [pubkey ...]\n"
+                    "\n"
+                    "OPTIONS\n"
+                    "   -h              Display program help and usage.\n"
+                    "   -v              Display verbose program output.\n"
+                    "   -K keyring      Audit every key in a keyring (can be repeated).\n"
+                    "   -l listfile     Audit the public key files listed, one per line.\n"
+                    "   -t threads      Threads per tree level (default: number of CPUs).\n"
+                    "   -T tmpdir       Directory for tree levels spilled to disk\n"
+                    "                   (default: $TMPDIR or /tmp).\n"
+                    "   -m megabytes    Tree size to keep in memory before spilling (default: 1024).\n"
+                    "   pubkey ...      Public key files to audit.\n");
+    return;
+}
+
+typedef enum { VERBOSE } KeyAudit;
+#define OPTIONS "hvK:l:t:T:m:"
+
+// The moduli being audited and where each came from
+typedef struct {
+    mpz_t *n;
+    char **sources;
+    size_t count;
+    size_t size;
+} Keys;
+
+// This function adds a modulus to the keys
+// Inputs: the keys, the modulus and where it came from
+// Outputs: void
+
+static void add_key(Keys *keys, mpz_t n, const char *source) {
+    if (keys->count == keys->size) {
+        keys->size = (keys->size == 0) ? 1024 : 2 * keys->size;
+        keys->n = (mpz_t *) realloc(keys->n, keys->size * sizeof(mpz_t));
+        keys->sources = (char **) realloc(keys->sources, keys->size * sizeof(char *));
+    }
+    mpz_init_set(keys->n[keys->count], n);
+    keys->sources[keys->count] = strdup(source);
+    keys->count += 1;
+    return;
+}
+
+// This function adds the modulus of a public key file
+// Inputs: the keys, the key file path
+// Outputs: true if the file was read
+
+static bool add_pub(Keys *keys, const char *path) {
+    FILE *pbfile = fopen(path, "r");
+    if (pbfile == NULL) {
+        fprintf(stderr, "%s: No such file or directory\n", path);
+        return false;
+    }
+    mpz_t n, e, s;
+    mpz_inits(n, e, s, NULL);
+    char username[LOGIN_NAME_MAX] = "";
+    rsa_read_pub(n, e, s, username, pbfile);
+    fclose(pbfile);
+    bool ok = mpz_sgn(n) > 0;
+    if (ok) {
+        add_key(keys, n, path);
+    } else {
+        fprintf(stderr, "Error: invalid key %s.\n", path);
+    }
+    mpz_clears(n, e, s, NULL);
+    return ok;
+}
+
+// This function adds every public key file named in a list file
+// Inputs: the keys, the list file path
+// Outputs: true if the list and every file in it were read
+
+static bool add_list(Keys *keys, const char *listpath) {
+    FILE *list = fopen(listpath, "r");
+    if (list == NULL) {
+        fprintf(stderr, "%s: No such file or directory\n", listpath);
+        return false;
+    }
+    bool ok = true;
+    char path[PATH_MAX];
+    while (fscanf(list, "%4095s", path) == 1) {
+        ok = add_pub(keys, path) && ok;
+    }
+    fclose(list);
+    return ok;
+}
+
+// This function adds every key in a keyring, labelled keyring:user
+// Inputs: the keys, the keyring path
+// Outputs: true if the keyring was opened
+
+static bool add_keyring(Keys *keys, const char *path) {
+    Keyring *ring = keyring_open(path);
+    if (ring == NULL) {
+        fprintf(stderr, "%s: not a keyring\n", path);
+        return false;
+    }
+    mpz_t n, e, s;
+    mpz_inits(n, e, s, NULL);
+    char username[LOGIN_NAME_MAX];
+    char source[PATH_MAX + LOGIN_NAME_MAX + 2];
+    for (uint32_t i = 0; i < keyring_count(ring); i += 1) {
+        if (keyring_get(ring, i, n, e, s, username) && mpz_sgn(n) > 0) {
+            snprintf(source, sizeof(source), "%s:%s", path, username);
+            add_key(keys, n, source);
+        }
+    }
+    mpz_clears(n, e, s, NULL);
+    keyring_close(&ring);
+    return true;
+}
+
+// This function returns the seconds since some fixed point, for timing
+// Inputs: void
+// Outputs: seconds
+
+static double seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    Set chosen = empty_set();
+    int option = 0;
+    Keys keys = { 0 };
+    bool ok = true; // every key was read
+    bool audited = true;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    char *tmpdir = getenv("TMPDIR");
+    tmpdir = (tmpdir == NULL || tmpdir[0] == '\0') ? "/tmp" : tmpdir;
+    size_t megabytes = 1024;
+    double start = seconds();
+
+    while ((option = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (option) {
+        case 'h': message(); return 0;
+        case 'v':
+            // verbose printing was chosen
+            chosen = insert_set(VERBOSE, chosen);
+            break;
+        case 'K':
+            // keyring to audit
+            ok = add_keyring(&keys, optarg) && ok;
+            break;
+        case 'l':
+            // list of public key files to audit
+            ok = add_list(&keys, optarg) && ok;
+            break;
+        case 't':
+            // threads per tree level specified
+            threads = strtol(optarg, NULL, 10);
+            break;
+        case 'T':
+            // spill directory specified
+            tmpdir = optarg;
+            break;
+        case 'm':
+            // memory budget specified
+            megabytes = strtoul(optarg, NULL, 10);
+            break;
+        default: message(); return 1;
+        }
+    }
+    for (int i = optind; i < argc; i += 1) {
+        ok = add_pub(&keys, argv[i]) && ok;
+    }
+    threads = (threads < 1) ? 1 : threads;
+
+    if (member_set(VERBOSE, chosen)) {
+        fprintf(stderr, "read %zu keys in %.3fs\n", keys.count, seconds() - start);
+    }
+
+    // out[i] = gcd(n_i, product of every other modulus)
+    mpz_t *out = (mpz_t *) malloc((keys.count > 0 ? keys.count : 1) * sizeof(mpz_t));
+    for (size_t i = 0; i < keys.count; i += 1) {
+        mpz_init(out[i]);
+    }
+    double audit = seconds();
+    if (!batch_gcd(out, keys.n, keys.count, (int) threads, tmpdir, megabytes << 20)) {
+        fprintf(stderr, "%s: couldn't spill the trees to disk\n", tmpdir);
+        audited = false;
+    } else if (member_set(VERBOSE, chosen)) {
+        fprintf(stderr, "batch gcd of %zu keys on %ld threads in %.3fs\n", keys.count, threads,
+            seconds() - audit);
+    }
+
+    // a shared factor factors the modulus; sharing all of it is a repeated key
+    // or both primes reused, which the gcd alone can't split. Keys that couldn't
+    // be read don't stop the others being reported.
+    size_t weak = 0;
+    for (size_t i = 0; i < keys.count && audited; i += 1) {
+        if (mpz_cmp_ui(out[i], 1) == 0) {
+            continue;
+        }
+        weak += 1;
+        if (mpz_cmp(out[i], keys.n[i]) == 0) {
+            printf("%s: shares all of its modulus with other keys\n", keys.sources[i]);
+        } else {
+            gmp_printf("%s: shares the factor %Zx\n", keys.sources[i], out[i]);
+        }
+    }
+    if (member_set(VERBOSE, chosen)) {
+        fprintf(stderr, "%zu of %zu keys share a factor\n", weak, keys.count);
+    }
+
+    for (size_t i = 0; i < keys.count; i += 1) {
+        mpz_clears(keys.n[i], out[i], NULL);
+        free(keys.sources[i]);
+    }
+    free(keys.n);
+    free(keys.sources);
+    free(out);
+    return (!ok || !audited || weak > 0) ? 1 : 0;
+}
@@ -0,0 +1,114 @@
+// A cache of public keys whose signatures have already been checked with
+// rsa_verify(). Each verified key is an empty file named after the SHA-256 of
+// (n, e, s, username) inside a directory only the user can write to, so a hit
+// means this user already verified exactly that key.
+#include "keycache.h"
+#include "hex.h"
+#include "sha256.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+// The private_dir() function creates path if needed and checks that it is a
+// directory owned by us that nobody else can write to
+// Inputs: the directory path
+// Outputs: true if the directory is safe to use
+
+static bool private_dir(const char *path) {
+    if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+        return false;
+    }
+    struct stat st;
+    if (lstat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return false;
+    }
+    return st.st_uid == geteuid() && (st.st_mode & 0077) == 0;
+}
+
+// The keycache_dir() function finds the per-user cache directory
+// ($XDG_CACHE_HOME/rsa or ~/.cache/rsa), creating it if needed
+// Inputs: dir = output of PATH_MAX characters
+// Outputs: true if the directory exists and only we can write to it
+
+bool keycache_dir(char dir[]) {
+    char *base = getenv("XDG_CACHE_HOME");
+    char *home = getenv("HOME");
+    if (base != NULL && base[0] == '/') {
+        snprintf(dir, PATH_MAX, "%s/rsa", base);
+    } else if (home != NULL && home[0] == '/') {
+        snprintf(dir, PATH_MAX, "%s/.cache", home);
+        mkdir(dir, 0700); // the parent may not exist yet, it need not be private
+        snprintf(dir, PATH_MAX, "%s/.cache/rsa", home);
+    } else {
+        return false;
+    }
+    return private_dir(dir);
+}
+
+// The cache_path() function builds the path of the cache entry for a key,
+// creating the cache directory on the way
+// Inputs: path = output of PATH_MAX characters, the key and username
+// Outputs: true if there is a usable cache directory
+
+static bool cache_path(char path[], mpz_t n, mpz_t e, mpz_t s, char username[]) {
+    char dir[PATH_MAX];
+    if (!keycache_dir(dir)) {
+        return false;
+    }
+
+    // hash the key exactly as it appears in the public key file
+    SHA256 ctx;
+    sha256_init(&ctx);
+    mpz_ptr parts[3] = { n, e, s };
+    for (int i = 0; i < 3; i += 1) {
+        char *text = mpz_get_str(NULL, 16, parts[i]);
+        sha256_update(&ctx, text, strlen(text));
+        sha256_update(&ctx, "\n", 1);
+        free(text);
+    }
+    sha256_update(&ctx, username, strlen(username));
+
+    uint8_t digest[SHA256_DIGEST];
+    char name[2 * SHA256_DIGEST + 1];
+    sha256_final(&ctx, digest);
+    name[hex_encode(name, digest, SHA256_DIGEST)] = '\0';
+
+    return snprintf(path, PATH_MAX, "%s/%s", dir, name) < PATH_MAX;
+}
+
+// The keycache_lookup() function checks if a public key was already verified
+// Inputs: n = public modulus, e = public exponent, s = signature, the username
+// Outputs: true if the key is in the cache
+
+bool keycache_lookup(mpz_t n, mpz_t e, mpz_t s, char username[]) {
+    char path[PATH_MAX];
+    struct stat st;
+    if (!cache_path(path, n, e, s, username) || lstat(path, &st) != 0) {
+        return false;
+    }
+    return S_ISREG(st.st_mode) && st.st_uid == geteuid();
+}
+
+// The keycache_store() function records a public key as verified. It should only
+// be called once rsa_verify() has accepted the signature. Failures are ignored,
+// the next run simply verifies again.
+// Inputs: n = public modulus, e = public exponent, s = signature, the username
+// Outputs: void
+
+void keycache_store(mpz_t n, mpz_t e, mpz_t s, char username[]) {
+    char path[PATH_MAX];
+    if (!cache_path(path, n, e, s, username)) {
+        return;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_NOFOLLOW, 0600);
+    if (fd >= 0) {
+        close(fd);
+    }
+    return;
+}
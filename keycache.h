@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdbool.h>
+#include <gmp.h>
+
+bool keycache_dir(char dir[]);
+
+bool keycache_lookup(mpz_t n, mpz_t e, mpz_t s, char username[]);
+
+void keycache_store(mpz_t n, mpz_t e, mpz_t s, char username[]);
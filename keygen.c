@@ -2,6 +2,9 @@
 #include "randstate.h"
 #include "rsa.h"
 #include "set.h"
+#include "pool.h"
+#include "autotune.h"
+#include "backend.h"
 
 #include <stdio.h>
 #include <limits.h>
@@ -23,21 +26,121 @@ void message(void) {
                     "   Generates an RSA public/private key pair.\n"
                     "\n"
                     "USAGE\n"
-                    "   ./keygen [-hv] [-b bits] -n pbfile -d pvfile"
+                    "   ./keygen [-hvB] [-b bits] [-p pool] [--autotune] -n pbfile -d pvfile\n"
+                    "   ./keygen [-vB] [-b bits] [-p pool] --fill-pool count\n"
+                    "   ./keygen [-p pool] --pool-status\n"
                     "\n"
                     "OPTIONS\n"
                     "   -h              Display program help and usage.\n"
                     "   -v              Display verbose program output.\n"
                     "   -b bits         Minimum bits needed for public key n (default: 256).\n"
-                    "   -i confidence   Miller-Rabin iterations for testing primes (default: 50).\n"
+                    "   -i confidence   Miller-Rabin iterations for testing primes (default: 50),\n"
+                    "                   or extra random rounds after -B (default: 0).\n"
+                    "   -B, --bpsw      Test primes with Baillie-PSW instead of Miller-Rabin.\n"
                     "   -n pbfile       Public key file (default: rsa.pub).\n"
                     "   -d pvfile       Private key file (default: rsa.priv).\n"
-                    "   -s seed         Random seed for testing.\n");
+                    "   -s seed         Random seed for testing.\n"
+                    "   -p pool         Prime pool file, used when present (default: rsa.pool).\n"
+                    "   -F, --fill-pool count\n"
+                    "                   Add count prime pairs for -b bit keys to the pool and exit.\n"
+                    "                   Run it in the background to keep the pool topped up.\n"
+                    "   -S, --pool-status\n"
+                    "                   Show how many primes of each size the pool holds.\n"
+                    "   --autotune      Time the backends and window widths on -b bit keys, use\n"
+                    "                   the fastest and remember it for this host and key size.\n"
+                    "                   Later runs load it.\n");
     return;
 }
 
-typedef enum { VERBOSE } Keygen;
-#define OPTIONS "b:i:n:d:s:vh"
+typedef enum { VERBOSE, SEEDED, FILL, STATUS, BPSW, ITERS, AUTOTUNE } Keygen;
+#define OPTIONS "b:i:n:d:s:p:F:SBvh"
+
+static struct option long_options[] = {
+    { "pool", required_argument, NULL, 'p' },
+    { "fill-pool", required_argument, NULL, 'F' },
+    { "pool-status", no_argument, NULL, 'S' },
+    { "bpsw", no_argument, NULL, 'B' },
+    { "autotune", no_argument, NULL, 'A' },
+    { NULL, 0, NULL, 0 },
+};
+
+// This function makes primes for the pool until count pairs have been added
+// Inputs: the pool path, count, the key size, Miller-Rabin iterations, and the
+// chosen options
+// Outputs: 0 on success, 1 if the pool couldn't be written
+
+int fill_pool(char *poolpath, uint64_t count, uint64_t bits, uint64_t iters, Set chosen) {
+    uint64_t pbits = bits / 2;
+    uint64_t qbits = bits - pbits;
+    mpz_t p;
+    mpz_init(p);
+    for (uint64_t i = 0; i < count; i += 1) {
+        // both halves of the key, which are the same size unless bits is odd
+        make_prime(p, pbits, iters);
+        bool ok = pool_add(poolpath, pbits, p);
+        make_prime(p, qbits, iters);
+        ok = ok && pool_add(poolpath, qbits, p);
+        if (!ok) {
+            fprintf(stderr, "%s: couldn't write to the pool\n", poolpath);
+            mpz_clear(p);
+            return 1;
+        }
+        if (member_set(VERBOSE, chosen)) {
+            printf("added pair %" PRIu64 " of %" PRIu64 "\n", i + 1, count);
+        }
+    }
+    mpz_clear(p);
+    pool_status(poolpath, stdout);
+    return 0;
+}
+
+// This function picks the arithmetic for making keys of this size on this host,
+// tuning it if asked to and loading what was tuned before otherwise. Making
+// primes is mostly Miller-Rabin, which is pow_mod with an exponent as long as
+// the modulus, so that is what gets timed. Backends draw from the random state
+// differently, so with -s the keys must come from the backend the program was
+// built with: a seeded run tunes and saves if asked to, but never switches.
+// Inputs: the key size and the chosen options
+// Outputs: void
+
+void tune(uint64_t bits, Set chosen) {
+    Profile profile;
+    char built[16];
+    snprintf(built, sizeof(built), "%s", numtheory_backend());
+    if (member_set(AUTOTUNE, chosen)) {
+        // random numbers of the size of p, from a state of their own so that
+        // -s still makes the same keys
+        gmp_randstate_t rand;
+        gmp_randinit_default(rand);
+        mpz_t exponent, modulus;
+        mpz_inits(exponent, modulus, NULL);
+        mpz_urandomb(modulus, rand, bits / 2);
+        mpz_setbit(modulus, bits / 2 - 1);
+        mpz_setbit(modulus, 0);
+        mpz_urandomb(exponent, rand, bits / 2);
+        autotune_run(&profile, exponent, modulus, false);
+        if (!autotune_save(&profile, "keygen", bits)) {
+            fprintf(stderr, "autotune: couldn't save the profile\n");
+        }
+        mpz_clears(exponent, modulus, NULL);
+        gmp_randclear(rand);
+        if (member_set(SEEDED, chosen)) {
+            set_backend(built);
+            set_window_width(0);
+        }
+    } else if (!member_set(SEEDED, chosen) && autotune_load(&profile, "keygen", bits)) {
+        autotune_apply(&profile);
+    } else {
+        return;
+    }
+    if (member_set(VERBOSE, chosen)) {
+        autotune_print(&profile, member_set(AUTOTUNE, chosen) ? "tuned" : "cached");
+        if (member_set(SEEDED, chosen)) {
+            fprintf(stderr, "autotune: not used with -s, keeping the %s backend\n", built);
+        }
+    }
+    return;
+}
 
 int main(int argc, char **argv) {
     // Declare default values and set
@@ -46,6 +149,8 @@ int main(int argc, char **argv) {
     uint64_t bits = 256;
     uint64_t iters = 50;
     uint64_t seed = time(NULL);
+    uint64_t fill = 0;
+    char *poolpath = "rsa.pool";
 
     // public and private files to be used and default paths
     FILE *pbfile;
@@ -56,7 +161,7 @@ int main(int argc, char **argv) {
     // Parse command line inputs
     // If help was chosen or something went wrong, send user to
     // the usage message and end the program
-    while ((option = getopt(argc, argv, OPTIONS)) != -1) {
+    while ((option = getopt_long(argc, argv, OPTIONS, long_options, NULL)) != -1) {
         switch (option) {
         case 'h': message(); return 0;
         case 'v':
@@ -82,15 +187,62 @@ int main(int argc, char **argv) {
         case 'i':
             // number of iterations is specified
             iters = (uint64_t) strtoul(optarg, NULL, 10);
+            chosen = insert_set(ITERS, chosen);
             break;
         case 's':
             // specifies the random seed
             seed = (uint64_t) strtoul(optarg, NULL, 10);
+            chosen = insert_set(SEEDED, chosen);
+            break;
+        case 'p':
+            // prime pool file path
+            poolpath = optarg;
+            break;
+        case 'F':
+            // fill the pool instead of making keys
+            fill = (uint64_t) strtoul(optarg, NULL, 10);
+            chosen = insert_set(FILL, chosen);
+            break;
+        case 'S':
+            // show the pool fill level
+            chosen = insert_set(STATUS, chosen);
+            break;
+        case 'B':
+            // Baillie-PSW primality testing
+            chosen = insert_set(BPSW, chosen);
+            break;
+        case 'A':
+            // tune for this host and key size
+            chosen = insert_set(AUTOTUNE, chosen);
             break;
         default: message(); return 0;
         }
     }
 
+    // with Baillie-PSW, -i only adds random rounds on top
+    if (member_set(BPSW, chosen)) {
+        set_prime_test(PRIME_BPSW);
+        iters = member_set(ITERS, chosen) ? iters : 0;
+    }
+
+    // the pool modes don't make a key
+    if (member_set(STATUS, chosen)) {
+        pool_status(poolpath, stdout);
+        return 0;
+    }
+    tune(bits, chosen);
+    if (member_set(FILL, chosen)) {
+        // pooled primes outlive this run, so never derive them from the clock
+        if (!member_set(SEEDED, chosen) && !random_bytes((uint8_t *) &seed, sizeof(seed))) {
+            fprintf(stderr, "Error: no random seed for the pool.\n");
+            return 1;
+        }
+        randstate_init(seed);
+        int status = fill_pool(poolpath, fill, bits, iters, chosen);
+        randstate_clear();
+        return status;
+    }
+
     // open the public and private files
     pbfile = fopen(pbpath, "w");
     if (pbfile == NULL) {
@@ -115,8 +267,15 @@ int main(int argc, char **argv) {
     mpz_t p, q, n, d, e, name, s;
     mpz_inits(p, q, n, d, e, name, s, NULL);
 
-    // make the public and private keys
-    rsa_make_pub(p, q, n, e, bits, iters);
+    // make the public and private keys, with primes from the pool if it has them,
+    // except that a seed must decide the primes
+    bool pooled = !member_set(SEEDED, chosen) && pool_take_pair(poolpath, bits, p, q);
+    if (pooled) {
+        mpz_mul(n, p, q);
+        rsa_make_exp(e, p, q, bits);
+    } else {
+        rsa_make_pub(p, q, n, e, bits, iters);
+    }
     rsa_make_priv(d, e, p, q);
 
     // get the username
@@ -131,6 +290,13 @@ int main(int argc, char **argv) {
 
     // if verbose printing was chosen, print the variable values
     if (member_set(VERBOSE, chosen)) {
+        if (pooled) {
+            printf("primes from %s (%" PRIu64 " left)\n", poolpath, pool_count(poolpath, 0));
+        } else if (member_set(SEEDED, chosen)) {
+            printf("primes from the seed, %s not used\n", poolpath);
+        } else {
+            printf("primes searched for, %s has none of this size\n", poolpath);
+        }
         gmp_printf("user = %s\n", username); // username
         gmp_printf("s (%d bits) = %Zd\n", mpz_sizeinbase(s, 2), s); // signature
         gmp_printf("p (%d bits) = %Zd\n", mpz_sizeinbase(p, 2), p); // prime number p
@@ -0,0 +1,384 @@
+// A keyring holds many public keys in one binary file that is mapped into
+// memory and looked up in place, so finding one key among tens of thousands
+// costs a hash and a probe or two instead of parsing every key. All integers
+// are little-endian and every record is 8 byte aligned:
+//
+//   header     "RSAKEYRG", u32 version, u32 count, u32 buckets, u32 0, u64 size
+//   offsets    u64 file offset of each record
+//   by user    u32 buckets slots, record number + 1 or 0 if empty, hashed by
+//              FNV-1a of the username
+//   by key     the same, hashed by the first 8 bytes of rsa_fingerprint(n)
+//   records    fingerprint[32], u32 name length, u32 n, e and s limb counts,
+//              the name padded to 8 bytes, then n, e and s as arrays of u64
+//              limbs, least significant first
+//
+// Both indexes use linear probing and are at most half full.
+#include "keyring.h"
+#include "rsa.h"
+#include "sha256.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define HEADER 32
+#define RECORD 48 // fixed part of a record
+#define LIMB   8
+
+struct Keyring {
+    const uint8_t *map;
+    uint64_t size;
+    uint32_t count;
+    uint32_t buckets;
+    const uint8_t *offsets;
+    const uint8_t *by_user;
+    const uint8_t *by_key;
+};
+
+// One record, pointing into the mapped file
+typedef struct {
+    const uint8_t *fp;
+    const char *name;
+    uint32_t namelen;
+    const uint8_t *limbs[3]; // n, e, s
+    uint32_t counts[3];
+} Record;
+
+static uint32_t get32(const uint8_t *p) {
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static uint64_t get64(const uint8_t *p) {
+    return (uint64_t) get32(p) | (uint64_t) get32(p + 4) << 32;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i += 1) {
+        p[i] = (uint8_t) (v >> (8 * i));
+    }
+    return;
+}
+
+static void put64(uint8_t *p, uint64_t v) {
+    put32(p, (uint32_t) v);
+    put32(p + 4, (uint32_t) (v >> 32));
+    return;
+}
+
+static uint64_t align8(uint64_t v) {
+    return (v + 7) & ~(uint64_t) 7;
+}
+
+// The hash_user() function hashes a username with 64 bit FNV-1a
+// Inputs: the name and its length
+// Outputs: the hash
+
+static uint64_t hash_user(const char *name, size_t len) {
+    uint64_t h = 0xcbf29ce484222325u;
+    for (size_t i = 0; i < len; i += 1) {
+        h = (h ^ (uint8_t) name[i]) * 0x100000001b3u;
+    }
+    return h;
+}
+
+// The hash_key() function hashes a fingerprint, which is already uniform
+// Inputs: the fingerprint
+// Outputs: the hash
+
+static uint64_t hash_key(const uint8_t fp[]) {
+    return get64(fp);
+}
+
+// The keyring_open() function maps a keyring file and checks its layout
+// Inputs: the path
+// Outputs: the keyring, or NULL if it can't be read or isn't a keyring
+
+Keyring *keyring_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < HEADER) {
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    Keyring *k = (Keyring *) calloc(1, sizeof(Keyring));
+    k->map = (const uint8_t *) map;
+    k->size = (uint64_t) st.st_size;
+    k->count = get32(k->map + 12);
+    k->buckets = get32(k->map + 16);
+    uint64_t tables = HEADER + (uint64_t) k->count * 8 + (uint64_t) k->buckets * 8;
+    if (memcmp(k->map, KEYRING_MAGIC, 8) != 0 || get32(k->map + 8) != KEYRING_VERSION
+        || get64(k->map + 24) != k->size || k->buckets == 0 || (k->buckets & (k->buckets - 1)) != 0
+        || k->buckets <= k->count || tables > k->size) {
+        keyring_close(&k);
+        return NULL;
+    }
+    k->offsets = k->map + HEADER;
+    k->by_user = k->offsets + (uint64_t) k->count * 8;
+    k->by_key = k->by_user + (uint64_t) k->buckets * 4;
+    return k;
+}
+
+// The keyring_close() function unmaps and frees the keyring
+// Inputs: the keyring
+// Outputs: void
+
+void keyring_close(Keyring **k) {
+    if (*k == NULL) {
+        return;
+    }
+    munmap((void *) (*k)->map, (size_t) (*k)->size);
+    free(*k);
+    *k = NULL;
+    return;
+}
+
+// The keyring_count() function gives the number of keys in the keyring
+// Inputs: the keyring
+// Outputs: the count
+
+uint32_t keyring_count(Keyring *k) {
+    return k->count;
+}
+
+// The record() function finds record i, checking that it lies inside the file
+// Inputs: the keyring, the record number, rec = output
+// Outputs: true if the record is well formed
+
+static bool record(Keyring *k, uint32_t i, Record *rec) {
+    if (i >= k->count) {
+        return false;
+    }
+    uint64_t off = get64(k->offsets + (uint64_t) i * 8);
+    if (off % 8 != 0 || off > k->size || k->size - off < RECORD) {
+        return false;
+    }
+    const uint8_t *p = k->map + off;
+    rec->fp = p;
+    rec->namelen = get32(p + SHA256_DIGEST);
+    if (rec->namelen >= LOGIN_NAME_MAX) {
+        return false;
+    }
+    rec->name = (const char *) p + RECORD;
+    uint64_t end = off + RECORD + align8(rec->namelen);
+    for (int j = 0; j < 3; j += 1) {
+        rec->counts[j] = get32(p + SHA256_DIGEST + 4 + 4 * j);
+        rec->limbs[j] = k->map + end;
+        end += (uint64_t) rec->counts[j] * LIMB;
+    }
+    return end <= k->size;
+}
+
+// The load() function copies a record's key out of the file
+// Inputs: the record, n, e, s and username = output carrying variables
+// (username may be NULL)
+// Outputs: void
+
+static void load(Record *rec, mpz_t n, mpz_t e, mpz_t s, char username[]) {
+    mpz_ptr parts[3] = { n, e, s };
+    for (int j = 0; j < 3; j += 1) {
+        mpz_import(parts[j], rec->counts[j], -1, LIMB, -1, 0, rec->limbs[j]);
+    }
+    if (username != NULL) {
+        memcpy(username, rec->name, rec->namelen);
+        username[rec->namelen] = '\0';
+    }
+    return;
+}
+
+// The keyring_get() function reads the i-th key, for listing a keyring
+// Inputs: the keyring, the record number, n, e, s and username (room for
+// LOGIN_NAME_MAX characters) = output carrying variables
+// Outputs: true if the record exists and is well formed
+
+bool keyring_get(Keyring *k, uint32_t i, mpz_t n, mpz_t e, mpz_t s, char username[]) {
+    Record rec;
+    if (!record(k, i, &rec)) {
+        return false;
+    }
+    load(&rec, n, e, s, username);
+    return true;
+}
+
+// The keyring_find_user() function looks a key up by username
+// Inputs: the keyring, the username, n, e and s = output carrying variables
+// Outputs: true if the user has a key in the keyring
+
+bool keyring_find_user(Keyring *k, const char *username, mpz_t n, mpz_t e, mpz_t s) {
+    size_t len = strlen(username);
+    uint32_t mask = k->buckets - 1;
+    uint32_t h = (uint32_t) hash_user(username, len) & mask;
+    for (uint32_t probe = 0; probe < k->buckets; probe += 1) {
+        uint32_t slot = get32(k->by_user + (uint64_t) h * 4);
+        Record rec;
+        if (slot == 0) {
+            return false;
+        }
+        if (record(k, slot - 1, &rec) && rec.namelen == len && memcmp(rec.name, username, len) == 0) {
+            load(&rec, n, e, s, NULL);
+            return true;
+        }
+        h = (h + 1) & mask;
+    }
+    return false;
+}
+
+// The keyring_find_fingerprint() function looks a key up by its fingerprint
+// Inputs: the keyring, the fingerprint, n, e, s and username (room for
+// LOGIN_NAME_MAX characters) = output carrying variables
+// Outputs: true if the key is in the keyring
+
+bool keyring_find_fingerprint(Keyring *k, const uint8_t fp[], mpz_t n, mpz_t e, mpz_t s, char username[]) {
+    uint32_t mask = k->buckets - 1;
+    uint32_t h = (uint32_t) hash_key(fp) & mask;
+    for (uint32_t probe = 0; probe < k->buckets; probe += 1) {
+        uint32_t slot = get32(k->by_key + (uint64_t) h * 4);
+        Record rec;
+        if (slot == 0) {
+            return false;
+        }
+        if (record(k, slot - 1, &rec) && memcmp(rec.fp, fp, SHA256_DIGEST) == 0) {
+            load(&rec, n, e, s, username);
+            return true;
+        }
+        h = (h + 1) & mask;
+    }
+    return false;
+}
+
+// The insert() function puts a record into an index. Usernames are unique by
+// now, but one key can be listed under two names; the later one wins.
+// Inputs: the file being built, the index, its size, the hash, the record
+// number, and whether it is the username index
+// Outputs: void
+
+static void insert(uint8_t *buf, uint8_t *index, uint32_t buckets, uint64_t hash, uint32_t i, bool by_user) {
+    uint32_t mask = buckets - 1;
+    uint32_t h = (uint32_t) hash & mask;
+    const uint8_t *mine = buf + get64(buf + HEADER + (uint64_t) i * 8);
+    for (;;) {
+        uint32_t slot = get32(index + (uint64_t) h * 4);
+        if (slot == 0) {
+            put32(index + (uint64_t) h * 4, i + 1);
+            return;
+        }
+        const uint8_t *other = buf + get64(buf + HEADER + (uint64_t) (slot - 1) * 8);
+        bool same = by_user ? get32(mine + SHA256_DIGEST) == get32(other + SHA256_DIGEST)
+                                  && memcmp(mine + RECORD, other + RECORD, get32(mine + SHA256_DIGEST)) == 0
+                            : memcmp(mine, other, SHA256_DIGEST) == 0;
+        if (same) {
+            put32(index + (uint64_t) h * 4, i + 1);
+            return;
+        }
+        h = (h + 1) & mask;
+    }
+}
+
+// The keyring_write() function writes a keyring holding the given keys. The
+// file is written beside path and renamed over it, so readers never see a
+// half written keyring.
+// Inputs: the path, the number of keys, and each key's n, e, s and username
+// Outputs: true if the keyring was written
+
+bool keyring_write(const char *path, uint32_t count, mpz_t n[], mpz_t e[], mpz_t s[], char *usernames[]) {
+    uint32_t buckets = 16;
+    while (buckets < 2 * (uint64_t) count) {
+        buckets *= 2;
+    }
+
+    // a username given more than once keeps only its last key
+    uint32_t *seen = (uint32_t *) calloc(buckets, sizeof(uint32_t));
+    bool *keep = (bool *) calloc(count + 1, sizeof(bool));
+    uint32_t kept = 0;
+    for (uint32_t i = count; i-- > 0;) {
+        uint32_t h = (uint32_t) hash_user(usernames[i], strlen(usernames[i])) & (buckets - 1);
+        while (seen[h] != 0 && strcmp(usernames[seen[h] - 1], usernames[i]) != 0) {
+            h = (h + 1) & (buckets - 1);
+        }
+        if (seen[h] == 0) {
+            seen[h] = i + 1;
+            keep[i] = true;
+            kept += 1;
+        }
+    }
+    free(seen);
+
+    // lay the file out first
+    uint64_t *offsets = (uint64_t *) calloc(kept + 1, sizeof(uint64_t));
+    uint32_t *which = (uint32_t *) calloc(kept + 1, sizeof(uint32_t));
+    uint64_t size = HEADER + (uint64_t) kept * 8 + (uint64_t) buckets * 8;
+    for (uint32_t i = 0, r = 0; i < count; i += 1) {
+        if (!keep[i]) {
+            continue;
+        }
+        which[r] = i;
+        offsets[r] = size;
+        size += RECORD + align8(strlen(usernames[i]));
+        mpz_ptr parts[3] = { n[i], e[i], s[i] };
+        for (int j = 0; j < 3; j += 1) {
+            size += ((mpz_sizeinbase(parts[j], 2) + 63) / 64) * LIMB;
+        }
+        r += 1;
+    }
+    free(keep);
+
+    uint8_t *buf = (uint8_t *) calloc(size, sizeof(uint8_t));
+    memcpy(buf, KEYRING_MAGIC, 8);
+    put32(buf + 8, KEYRING_VERSION);
+    put32(buf + 12, kept);
+    put32(buf + 16, buckets);
+    put64(buf + 24, size);
+    uint8_t *by_user = buf + HEADER + (uint64_t) kept * 8;
+    uint8_t *by_key = by_user + (uint64_t) buckets * 4;
+
+    for (uint32_t r = 0; r < kept; r += 1) {
+        uint32_t i = which[r];
+        put64(buf + HEADER + (uint64_t) r * 8, offsets[r]);
+        uint8_t *p = buf + offsets[r];
+        size_t len = strlen(usernames[i]);
+        rsa_fingerprint(p, n[i]);
+        put32(p + SHA256_DIGEST, (uint32_t) len);
+        memcpy(p + RECORD, usernames[i], len);
+        p += RECORD + align8(len);
+        mpz_ptr parts[3] = { n[i], e[i], s[i] };
+        for (int j = 0; j < 3; j += 1) {
+            size_t limbs = 0;
+            if (mpz_sgn(parts[j]) != 0) {
+                mpz_export(p, &limbs, -1, LIMB, -1, 0, parts[j]);
+            }
+            put32(buf + offsets[r] + SHA256_DIGEST + 4 + 4 * j, (uint32_t) limbs);
+            p += limbs * LIMB;
+        }
+        insert(buf, by_user, buckets, hash_user(usernames[i], len), r, true);
+        insert(buf, by_key, buckets, hash_key(buf + offsets[r]), r, false);
+    }
+
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *out = fopen(tmp, "wb");
+    bool ok = out != NULL;
+    if (ok) {
+        ok = fwrite(buf, sizeof(uint8_t), size, out) == size;
+        ok = (fclose(out) == 0) && ok;
+        ok = ok && rename(tmp, path) == 0;
+        if (!ok) {
+            unlink(tmp);
+        }
+    }
+    free(offsets);
+    free(which);
+    free(buf);
+    return ok;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <gmp.h>
+
+#define KEYRING_MAGIC   "RSAKEYRG" // first 8 bytes of a keyring file
+#define KEYRING_VERSION 1
+
+typedef struct Keyring Keyring;
+
+Keyring *keyring_open(const char *path);
+
+void keyring_close(Keyring **k);
+
+uint32_t keyring_count(Keyring *k);
+
+bool keyring_get(Keyring *k, uint32_t i, mpz_t n, mpz_t e, mpz_t s, char username[]);
+
+bool keyring_find_user(Keyring *k, const char *username, mpz_t n, mpz_t e, mpz_t s);
+
+bool keyring_find_fingerprint(Keyring *k, const uint8_t fp[], mpz_t n, mpz_t e, mpz_t s, char username[]);
+
+bool keyring_write(const char *path, uint32_t count, mpz_t n[], mpz_t e[], mpz_t s[], char *usernames[]);
@@ -0,0 +1,212 @@
+#include "keyring.h"
+#include "rsa.h"
+#include "set.h"
+#include "hex.h"
+#include "sha256.h"
+
+#include <stdio.h>
+#include <limits.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+// This function prints out information about how to properly use the file
+// Inputs: void
+// Outputs: void
+
+void message(void) {
+    fprintf(stderr, "SYNOPSIS\n"
+                    "   Builds and searches a binary keyring of public keys.\n"
+                    "   encrypt -u user finds a recipient's key in the keyring.\n"
+                    "\n"
+                    "USAGE\n"
+                    "   ./keyring [-hlv] [-K keyring] [-u user] [-f fingerprint] [pubkey ...]\n"
+                    "\n"
+                    "OPTIONS\n"
+                    "   -h              Display program help and usage.\n"
+                    "   -v              Display verbose program output.\n"
+                    "   -K keyring      Keyring file (default: rsa.keyring).\n"
+                    "   -l              List every key in the keyring.\n"
+                    "   -u user         Print the public key of user.\n"
+                    "   -f fingerprint  Print the public key with this fingerprint (hex).\n"
+                    "   pubkey ...      Public key files to add. A user already in the keyring\n"
+                    "                   gets the new key.\n");
+    return;
+}
+
+typedef enum { VERBOSE, LIST } KeyringTool;
+#define OPTIONS "hvlK:u:f:"
+
+// This function prints one key in the public key file format, with its fingerprint
+// Inputs: the key and username
+// Outputs: void
+
+static void print_key(mpz_t n, mpz_t e, mpz_t s, char username[], Set chosen) {
+    uint8_t fp[SHA256_DIGEST];
+    char hex[2 * SHA256_DIGEST + 1];
+    rsa_fingerprint(fp, n);
+    hex[hex_encode(hex, fp, SHA256_DIGEST)] = '\0';
+    if (member_set(VERBOSE, chosen)) {
+        printf("%s %s (%zu bits)\n", hex, username, mpz_sizeinbase(n, 2));
+        rsa_write_pub(n, e, s, username, stdout);
+    } else {
+        printf("%s %s\n", hex, username);
+    }
+    return;
+}
+
+// This function reads public key files and adds them to the keys that are
+// already in the keyring, then writes the keyring again
+// Inputs: the keyring path, the open keyring (or NULL), the key file paths
+// Outputs: 0 on success, 1 if any key couldn't be added
+
+static int add_keys(char *path, Keyring *ring, int paths, char **pbpaths) {
+    uint32_t old = (ring == NULL) ? 0 : keyring_count(ring);
+    uint32_t total = old + (uint32_t) paths;
+    mpz_t *n = (mpz_t *) calloc(total, sizeof(mpz_t));
+    mpz_t *e = (mpz_t *) calloc(total, sizeof(mpz_t));
+    mpz_t *s = (mpz_t *) calloc(total, sizeof(mpz_t));
+    char **usernames = (char **) calloc(total, sizeof(char *));
+    int status = 0;
+
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < old; i += 1) {
+        mpz_inits(n[count], e[count], s[count], NULL);
+        usernames[count] = (char *) calloc(LOGIN_NAME_MAX, sizeof(char));
+        if (keyring_get(ring, i, n[count], e[count], s[count], usernames[count])) {
+            count += 1;
+        } else {
+            mpz_clears(n[count], e[count], s[count], NULL);
+            free(usernames[count]);
+        }
+    }
+
+    // only keys with a valid signature go in, since encrypt trusts the name
+    mpz_t name;
+    mpz_init(name);
+    for (int i = 0; i < paths; i += 1) {
+        FILE *pbfile = fopen(pbpaths[i], "r");
+        if (pbfile == NULL) {
+            fprintf(stderr, "%s: No such file or directory\n", pbpaths[i]);
+            status = 1;
+            continue;
+        }
+        mpz_inits(n[count], e[count], s[count], NULL);
+        usernames[count] = (char *) calloc(LOGIN_NAME_MAX, sizeof(char));
+        rsa_read_pub(n[count], e[count], s[count], usernames[count], pbfile);
+        fclose(pbfile);
+        mpz_set_str(name, usernames[count], 62);
+        if (usernames[count][0] == '\0' || mpz_sgn(n[count]) == 0
+            || !rsa_verify(name, s[count], e[count], n[count])) {
+            fprintf(stderr, "Error: invalid key %s.\n", pbpaths[i]);
+            mpz_clears(n[count], e[count], s[count], NULL);
+            free(usernames[count]);
+            status = 1;
+            continue;
+        }
+        count += 1;
+    }
+    mpz_clear(name);
+
+    if (!keyring_write(path, count, n, e, s, usernames)) {
+        fprintf(stderr, "%s: couldn't write keyring\n", path);
+        status = 1;
+    }
+
+    for (uint32_t i = 0; i < count; i += 1) {
+        mpz_clears(n[i], e[i], s[i], NULL);
+        free(usernames[i]);
+    }
+    free(n);
+    free(e);
+    free(s);
+    free(usernames);
+    return status;
+}
+
+int main(int argc, char **argv) {
+    Set chosen = empty_set();
+    int option = 0;
+    char *path = "rsa.keyring";
+    char *user = NULL;
+    char *fphex = NULL;
+
+    while ((option = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (option) {
+        case 'h': message(); return 0;
+        case 'v':
+            // verbose printing was chosen
+            chosen = insert_set(VERBOSE, chosen);
+            break;
+        case 'l':
+            // list the keyring
+            chosen = insert_set(LIST, chosen);
+            break;
+        case 'K':
+            // keyring path specified
+            path = optarg;
+            break;
+        case 'u':
+            // look up a user
+            user = optarg;
+            break;
+        case 'f':
+            // look up a fingerprint
+            fphex = optarg;
+            break;
+        default: message(); return 1;
+        }
+    }
+
+    Keyring *ring = keyring_open(path);
+    int status = 0;
+    if (optind < argc) {
+        status = add_keys(path, ring, argc - optind, argv + optind);
+        keyring_close(&ring);
+        ring = keyring_open(path);
+    }
+    if (ring == NULL) {
+        fprintf(stderr, "%s: not a keyring\n", path);
+        return 1;
+    }
+
+    mpz_t n, e, s;
+    mpz_inits(n, e, s, NULL);
+    char username[LOGIN_NAME_MAX];
+    if (member_set(VERBOSE, chosen)) {
+        printf("%s: %" PRIu32 " keys\n", path, keyring_count(ring));
+    }
+    if (member_set(LIST, chosen)) {
+        for (uint32_t i = 0; i < keyring_count(ring); i += 1) {
+            if (keyring_get(ring, i, n, e, s, username)) {
+                print_key(n, e, s, username, chosen);
+            }
+        }
+    }
+    if (user != NULL) {
+        if (keyring_find_user(ring, user, n, e, s)) {
+            strncpy(username, user, LOGIN_NAME_MAX - 1);
+            username[LOGIN_NAME_MAX - 1] = '\0';
+            print_key(n, e, s, username, chosen);
+        } else {
+            fprintf(stderr, "%s: no key for %s\n", path, user);
+            status = 1;
+        }
+    }
+    if (fphex != NULL) {
+        uint8_t fp[SHA256_DIGEST];
+        if (strlen(fphex) == 2 * SHA256_DIGEST && hex_decode(fp, fphex, SHA256_DIGEST)
+            && keyring_find_fingerprint(ring, fp, n, e, s, username)) {
+            print_key(n, e, s, username, chosen);
+        } else {
+            fprintf(stderr, "%s: no key with fingerprint %s\n", path, fphex);
+            status = 1;
+        }
+    }
+
+    mpz_clears(n, e, s, NULL);
+    keyring_close(&ring);
+    return status;
+}
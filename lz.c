@@ -0,0 +1,394 @@
+// A small LZ77 codec in the style of LZ4, used to shrink plaintext before it is
+// RSA encrypted. Input is cut into chunks of LZ_CHUNK bytes and each chunk becomes
+// one frame:
+//
+//   type (1 byte)  0 = stored, 1 = compressed
+//   raw length     4 bytes, big endian
+//   payload length 4 bytes, big endian
+//   payload
+//
+// A compressed payload is a list of sequences: a token byte (literal count in the
+// high nibble, match length - 4 in the low nibble, 15 meaning more length bytes
+// follow), the literals, then a 2 byte little endian offset back into the output.
+// The last sequence has literals only.
+#include "lz.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_MATCH   4
+#define MAX_OFFSET  65535
+#define HASH_BITS   14
+#define FRAME_HEAD  9
+#define WORTHWHILE(raw, packed) ((packed) < (raw) - (raw) / 8) // must save at least 1/8
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hash32(uint32_t v) {
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// The put_length() function writes the part of a length that didn't fit in the
+// token nibble, as a run of 255s and a final byte
+// Inputs: dst = output position, extra = length - 15
+// Outputs: the new output position
+
+static uint8_t *put_length(uint8_t *dst, size_t extra) {
+    while (extra >= 255) {
+        *dst++ = 255;
+        extra -= 255;
+    }
+    *dst++ = (uint8_t) extra;
+    return dst;
+}
+
+// The put_sequence() function writes literals and, if mlen > 0, the match after them
+// Inputs: dst = output position, lit = literals, litlen = number of literals,
+// offset and mlen = the match (mlen is 0 for the last sequence)
+// Outputs: the new output position
+
+static uint8_t *put_sequence(uint8_t *dst, const uint8_t *lit, size_t litlen, size_t offset, size_t mlen) {
+    size_t ml = (mlen > 0) ? mlen - MIN_MATCH : 0;
+    uint8_t *token = dst++;
+    *token = (uint8_t) (((litlen < 15 ? litlen : 15) << 4) | (ml < 15 ? ml : 15));
+    if (litlen >= 15) {
+        dst = put_length(dst, litlen - 15);
+    }
+    memcpy(dst, lit, litlen);
+    dst += litlen;
+    if (mlen > 0) {
+        *dst++ = (uint8_t) offset;
+        *dst++ = (uint8_t) (offset >> 8);
+        if (ml >= 15) {
+            dst = put_length(dst, ml - 15);
+        }
+    }
+    return dst;
+}
+
+// The lz_compress() function compresses one block with a greedy hash table match
+// finder
+// Inputs: dst = output, must hold LZ_BOUND(len) bytes, src = input, len = its size
+// Outputs: the compressed size
+
+size_t lz_compress(uint8_t *dst, const uint8_t *src, size_t len) {
+    uint32_t *table = (uint32_t *) calloc(1 << HASH_BITS, sizeof(uint32_t));
+    uint8_t *op = dst;
+    size_t ip = 0;
+    size_t anchor = 0;
+
+    while (ip + MIN_MATCH <= len) {
+        uint32_t h = hash32(read32(src + ip));
+        size_t cand = table[h];
+        table[h] = (uint32_t) ip;
+        if (cand >= ip || ip - cand > MAX_OFFSET || read32(src + cand) != read32(src + ip)) {
+            ip += 1;
+            continue;
+        }
+        size_t mlen = MIN_MATCH;
+        while (ip + mlen < len && src[cand + mlen] == src[ip + mlen]) {
+            mlen += 1;
+        }
+        op = put_sequence(op, src + anchor, ip - anchor, ip - cand, mlen);
+        ip += mlen;
+        anchor = ip;
+    }
+    op = put_sequence(op, src + anchor, len - anchor, 0, 0);
+
+    free(table);
+    return (size_t) (op - dst);
+}
+
+// The get_length() function reads the extra bytes of a length
+// Inputs: src and its size, ip = position (advanced), length = value to add to
+// Outputs: true if the bytes were all there
+
+static bool get_length(const uint8_t *src, size_t srclen, size_t *ip, size_t *length) {
+    uint8_t b;
+    do {
+        if (*ip >= srclen) {
+            return false;
+        }
+        b = src[(*ip)++];
+        *length += b;
+    } while (b == 255);
+    return true;
+}
+
+// The lz_decompress() function undoes lz_compress(), checking every length and
+// offset against the buffers so corrupt input can't write out of bounds
+// Inputs: dst = output, dstlen = the exact decompressed size, src = compressed
+// data, srclen = its size
+// Outputs: true if src decoded to exactly dstlen bytes
+
+bool lz_decompress(uint8_t *dst, size_t dstlen, const uint8_t *src, size_t srclen) {
+    size_t ip = 0;
+    size_t op = 0;
+    while (ip < srclen) {
+        uint8_t token = src[ip++];
+        size_t litlen = token >> 4;
+        if (litlen == 15 && !get_length(src, srclen, &ip, &litlen)) {
+            return false;
+        }
+        if (litlen > srclen - ip || litlen > dstlen - op) {
+            return false;
+        }
+        memcpy(dst + op, src + ip, litlen);
+        ip += litlen;
+        op += litlen;
+        if (ip == srclen) {
+            break; // the last sequence has no match
+        }
+
+        if (srclen - ip < 2) {
+            return false;
+        }
+        size_t offset = src[ip] | ((size_t) src[ip + 1] << 8);
+        ip += 2;
+        size_t mlen = token & 0x0F;
+        if (mlen == 15 && !get_length(src, srclen, &ip, &mlen)) {
+            return false;
+        }
+        mlen += MIN_MATCH;
+        if (offset == 0 || offset > op || mlen > dstlen - op) {
+            return false;
+        }
+        // byte by byte, since the match may overlap what it is copying
+        for (size_t i = 0; i < mlen; i += 1) {
+            dst[op + i] = dst[op - offset + i];
+        }
+        op += mlen;
+    }
+    return op == dstlen;
+}
+
+// The put_frame() function builds the frame for one chunk, storing it as is
+// when compression doesn't help
+// Inputs: frame = output of FRAME_HEAD + LZ_BOUND(len) bytes, raw = the chunk,
+// len = its size
+// Outputs: the frame size
+
+static size_t put_frame(uint8_t *frame, const uint8_t *raw, size_t len) {
+    size_t packed = lz_compress(frame + FRAME_HEAD, raw, len);
+    frame[0] = 1;
+    if (packed >= len) {
+        memcpy(frame + FRAME_HEAD, raw, len);
+        packed = len;
+        frame[0] = 0;
+    }
+    for (int i = 0; i < 4; i += 1) {
+        frame[1 + i] = (uint8_t) (len >> (24 - 8 * i));
+        frame[5 + i] = (uint8_t) (packed >> (24 - 8 * i));
+    }
+    return FRAME_HEAD + packed;
+}
+
+struct LZReader {
+    FILE *infile;
+    uint8_t *raw; // the chunk being compressed
+    size_t raw_len;
+    uint8_t *frame; // its frame, handed out from frame_pos to frame_len
+    size_t frame_len;
+    size_t frame_pos;
+    bool worthwhile;
+    bool passthrough;
+};
+
+// The fill() function reads a whole chunk unless the input ends first
+// Inputs: the reader
+// Outputs: the number of bytes read
+
+static size_t fill(LZReader *r) {
+    size_t total = 0;
+    size_t j;
+    while (total < LZ_CHUNK
+           && (j = fread(r->raw + total, sizeof(uint8_t), LZ_CHUNK - total, r->infile)) > 0) {
+        total += j;
+    }
+    return total;
+}
+
+// The lz_reader_create() function makes a compressing reader over infile. The
+// first chunk is compressed straight away to judge whether compression pays off.
+// Inputs: the input file
+// Outputs: the new reader
+
+LZReader *lz_reader_create(FILE *infile) {
+    LZReader *r = (LZReader *) calloc(1, sizeof(LZReader));
+    r->infile = infile;
+    r->raw = (uint8_t *) malloc(LZ_CHUNK);
+    r->frame = (uint8_t *) malloc(FRAME_HEAD + LZ_BOUND(LZ_CHUNK));
+    r->raw_len = fill(r);
+    if (r->raw_len > 0) {
+        r->frame_len = put_frame(r->frame, r->raw, r->raw_len);
+        r->worthwhile = WORTHWHILE(r->raw_len, r->frame_len - FRAME_HEAD);
+    }
+    return r;
+}
+
+// The lz_reader_delete() function frees a reader
+// Inputs: the reader
+// Outputs: void
+
+void lz_reader_delete(LZReader **r) {
+    free((*r)->raw);
+    free((*r)->frame);
+    free(*r);
+    *r = NULL;
+    return;
+}
+
+// The lz_reader_worthwhile() function tells if the first chunk compressed enough
+// (by at least an eighth) to be worth the frame overhead and decompression
+// Inputs: the reader
+// Outputs: true if the input should be compressed
+
+bool lz_reader_worthwhile(LZReader *r) {
+    return r->worthwhile;
+}
+
+// The lz_reader_passthrough() function turns compression off, so lz_read() hands
+// out the input unchanged. It must be called before the first lz_read().
+// Inputs: the reader
+// Outputs: void
+
+void lz_reader_passthrough(LZReader *r) {
+    r->passthrough = true;
+    memcpy(r->frame, r->raw, r->raw_len);
+    r->frame_len = r->raw_len;
+    r->frame_pos = 0;
+    return;
+}
+
+// The lz_read() function hands out the compressed stream, filling buf completely
+// unless the stream ends
+// Inputs: the reader, buf = output, len = the most bytes to read
+// Outputs: the number of bytes read, 0 at end of input
+
+size_t lz_read(void *reader, uint8_t *buf, size_t len) {
+    LZReader *r = (LZReader *) reader;
+    size_t total = 0;
+    while (total < len) {
+        if (r->frame_pos == r->frame_len) {
+            r->raw_len = fill(r);
+            if (r->raw_len == 0) {
+                break;
+            }
+            if (r->passthrough) {
+                memcpy(r->frame, r->raw, r->raw_len);
+                r->frame_len = r->raw_len;
+            } else {
+                r->frame_len = put_frame(r->frame, r->raw, r->raw_len);
+            }
+            r->frame_pos = 0;
+        }
+        size_t take = r->frame_len - r->frame_pos;
+        take = (take < len - total) ? take : len - total;
+        memcpy(buf + total, r->frame + r->frame_pos, take);
+        r->frame_pos += take;
+        total += take;
+    }
+    return total;
+}
+
+struct LZWriter {
+    FILE *outfile;
+    uint8_t *frame; // the frame being collected
+    size_t have;
+    size_t need; // bytes in the frame once complete
+    uint8_t *raw;
+    bool failed;
+};
+
+// The lz_writer_create() function makes a decompressing writer into outfile
+// Inputs: the output file
+// Outputs: the new writer
+
+LZWriter *lz_writer_create(FILE *outfile) {
+    LZWriter *w = (LZWriter *) calloc(1, sizeof(LZWriter));
+    w->outfile = outfile;
+    w->frame = (uint8_t *) malloc(FRAME_HEAD + LZ_BOUND(LZ_CHUNK));
+    w->raw = (uint8_t *) malloc(LZ_CHUNK);
+    w->need = FRAME_HEAD;
+    return w;
+}
+
+// The lz_writer_delete() function frees a writer
+// Inputs: the writer
+// Outputs: true if the stream was complete and well formed
+
+bool lz_writer_delete(LZWriter **w) {
+    bool ok = !(*w)->failed && (*w)->have == 0;
+    free((*w)->frame);
+    free((*w)->raw);
+    free(*w);
+    *w = NULL;
+    return ok;
+}
+
+// The finish_frame() function decodes a complete frame and writes it out
+// Inputs: the writer
+// Outputs: true if the frame was valid
+
+static bool finish_frame(LZWriter *w) {
+    size_t raw = 0;
+    for (int i = 0; i < 4; i += 1) {
+        raw = (raw << 8) | w->frame[1 + i];
+    }
+    size_t packed = w->need - FRAME_HEAD;
+    if (w->frame[0] == 0) {
+        if (raw != packed) {
+            return false;
+        }
+        fwrite(w->frame + FRAME_HEAD, sizeof(uint8_t), packed, w->outfile);
+        return true;
+    }
+    if (w->frame[0] != 1 || raw > LZ_CHUNK
+        || !lz_decompress(w->raw, raw, w->frame + FRAME_HEAD, packed)) {
+        return false;
+    }
+    fwrite(w->raw, sizeof(uint8_t), raw, w->outfile);
+    return true;
+}
+
+// The lz_write() function takes the next part of a compressed stream, which may
+// split frames anywhere, and writes out the decompressed data
+// Inputs: the writer, the data and its length
+// Outputs: void
+
+void lz_write(void *writer, const uint8_t *buf, size_t len) {
+    LZWriter *w = (LZWriter *) writer;
+    while (len > 0 && !w->failed) {
+        size_t take = (w->need - w->have < len) ? w->need - w->have : len;
+        memcpy(w->frame + w->have, buf, take);
+        w->have += take;
+        buf += take;
+        len -= take;
+        if (w->have < w->need) {
+            break;
+        }
+        if (w->need == FRAME_HEAD) {
+            // header done, now wait for the payload
+            size_t packed = 0;
+            for (int i = 0; i < 4; i += 1) {
+                packed = (packed << 8) | w->frame[5 + i];
+            }
+            if (packed > LZ_BOUND(LZ_CHUNK)) {
+                w->failed = true;
+                break;
+            }
+            w->need += packed;
+            if (packed > 0) {
+                continue;
+            }
+        }
+        w->failed = !finish_frame(w);
+        w->have = 0;
+        w->need = FRAME_HEAD;
+    }
+    return;
+}
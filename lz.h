@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define LZ_MAGIC     "RSALZ" // first word of a compressed single-recipient file
+#define LZ_VERSION   1
+#define LZ_CHUNK     (64 * 1024) // bytes compressed at a time
+#define LZ_BOUND(n)  ((n) + (n) / 255 + 16) // worst case size of compressing n bytes
+
+typedef struct LZReader LZReader;
+
+typedef struct LZWriter LZWriter;
+
+size_t lz_compress(uint8_t *dst, const uint8_t *src, size_t len);
+
+bool lz_decompress(uint8_t *dst, size_t dstlen, const uint8_t *src, size_t srclen);
+
+LZReader *lz_reader_create(FILE *infile);
+
+void lz_reader_delete(LZReader **r);
+
+bool lz_reader_worthwhile(LZReader *r);
+
+void lz_reader_passthrough(LZReader *r);
+
+size_t lz_read(void *r, uint8_t *buf, size_t len);
+
+LZWriter *lz_writer_create(FILE *outfile);
+
+bool lz_writer_delete(LZWriter **w);
+
+void lz_write(void *w, const uint8_t *buf, size_t len);
@@ -0,0 +1,290 @@
+// Latency metrics for encrypt and decrypt. Every block's pow_mod and every read
+// and write call can be timed into an HDR-style histogram: values below 32ns
+// get a bucket each, and above that every power of two is split into 32 equal
+// buckets, so any recorded value is known to within about 3% over the whole
+// 64 bit range without keeping the values themselves.
+//
+// Each thread records into its own shard, found through a thread local pointer,
+// and only that thread ever writes to it, so recording is a few relaxed atomic
+// stores with no locking. Shards are pushed onto a lock-free list the first time
+// a thread records, and metrics_write() merges them all into one histogram.
+#include "metrics.h"
+
+#include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define SUB_BITS 5
+#define SUB      (1u << SUB_BITS) // buckets per power of two
+#define BUCKETS  ((64 - SUB_BITS + 1) * SUB)
+
+typedef struct Shard {
+    _Atomic uint64_t counts[METRICS][BUCKETS];
+    _Atomic uint64_t total[METRICS];
+    _Atomic uint64_t sum[METRICS]; // nanoseconds
+    _Atomic uint64_t max[METRICS];
+    _Atomic uint64_t slow[METRICS]; // values above the threshold
+    struct Shard *next;
+} Shard;
+
+struct Metrics {
+    uint64_t id;
+    uint64_t threshold; // nanoseconds
+    _Atomic(Shard *) shards;
+};
+
+Metrics *metrics = NULL;
+
+static _Atomic uint64_t next_id = 1;
+static _Thread_local Shard *local = NULL;
+static _Thread_local uint64_t local_id = 0;
+
+static const char *labels[METRICS] = { "read", "pow_mod", "write" };
+
+// The bucket() function finds the histogram bucket for a value
+// Inputs: the value
+// Outputs: the bucket index
+
+static unsigned bucket(uint64_t v) {
+    if (v < SUB) {
+        return (unsigned) v;
+    }
+    unsigned msb = 63 - (unsigned) __builtin_clzll(v);
+    unsigned group = msb - SUB_BITS + 1;
+    unsigned sub = (unsigned) (v >> (msb - SUB_BITS)) - SUB;
+    return group * SUB + sub;
+}
+
+// The bucket_top() function finds the largest value that lands in a bucket
+// Inputs: the bucket index
+// Outputs: the value
+
+static uint64_t bucket_top(unsigned i) {
+    unsigned group = i / SUB;
+    uint64_t sub = i % SUB;
+    if (group == 0) {
+        return sub;
+    }
+    return ((SUB + sub + 1) << (group - 1)) - 1;
+}
+
+// The bump() function adds to a counter only this thread writes, which needs
+// no atomic read-modify-write
+// Inputs: the counter and the amount
+// Outputs: void
+
+static inline void bump(_Atomic uint64_t *counter, uint64_t by) {
+    uint64_t v = atomic_load_explicit(counter, memory_order_relaxed);
+    atomic_store_explicit(counter, v + by, memory_order_relaxed);
+    return;
+}
+
+// The metrics_create() function makes an empty set of histograms
+// Inputs: operations slower than threshold_ns are also counted separately
+// Outputs: the metrics
+
+Metrics *metrics_create(uint64_t threshold_ns) {
+    Metrics *m = (Metrics *) malloc(sizeof(Metrics));
+    m->id = atomic_fetch_add(&next_id, 1);
+    m->threshold = threshold_ns;
+    atomic_init(&m->shards, NULL);
+    return m;
+}
+
+// The metrics_delete() function frees the metrics and every thread's shard.
+// No thread may still be recording.
+// Inputs: the metrics
+// Outputs: void
+
+void metrics_delete(Metrics **m) {
+    if (*m == NULL) {
+        return;
+    }
+    Shard *s = atomic_load(&(*m)->shards);
+    while (s != NULL) {
+        Shard *next = s->next;
+        free(s);
+        s = next;
+    }
+    if (metrics == *m) {
+        metrics = NULL;
+    }
+    free(*m);
+    *m = NULL;
+    return;
+}
+
+// The shard() function finds this thread's shard, making it on first use
+// Inputs: the metrics
+// Outputs: the shard
+
+static Shard *shard(Metrics *m) {
+    if (local_id == m->id) {
+        return local;
+    }
+    Shard *s = (Shard *) calloc(1, sizeof(Shard));
+    s->next = atomic_load(&m->shards);
+    while (!atomic_compare_exchange_weak(&m->shards, &s->next, s)) {
+    }
+    local = s;
+    local_id = m->id;
+    return s;
+}
+
+// The metrics_record() function adds one latency to a histogram
+// Inputs: the metrics, which operation, and how long it took in nanoseconds
+// Outputs: void
+
+void metrics_record(Metrics *m, Metric which, uint64_t ns) {
+    Shard *s = shard(m);
+    bump(&s->counts[which][bucket(ns)], 1);
+    bump(&s->total[which], 1);
+    bump(&s->sum[which], ns);
+    if (ns > atomic_load_explicit(&s->max[which], memory_order_relaxed)) {
+        atomic_store_explicit(&s->max[which], ns, memory_order_relaxed);
+    }
+    if (ns > m->threshold) {
+        bump(&s->slow[which], 1);
+    }
+    return;
+}
+
+// The now() function reads the monotonic clock
+// Inputs: void
+// Outputs: the time in nanoseconds
+
+static uint64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+// The metrics_start() function starts timing into the global metrics. It
+// doesn't read the clock when nothing is being recorded.
+// Inputs: void
+// Outputs: the start time to pass to metrics_lap()
+
+uint64_t metrics_start(void) {
+    return (metrics == NULL) ? 0 : now();
+}
+
+// The metrics_lap() function records the time since start into the global
+// metrics and starts timing the next operation
+// Inputs: which operation just ended, and when it started
+// Outputs: the start time for the next operation
+
+uint64_t metrics_lap(Metric which, uint64_t start) {
+    if (metrics == NULL) {
+        return 0;
+    }
+    uint64_t t = now();
+    metrics_record(metrics, which, t - start);
+    return t;
+}
+
+// The merge() function adds up one operation's histogram over every shard
+// Inputs: the metrics, the operation, counts = output of BUCKETS entries
+// Outputs: the total count
+
+static uint64_t merge(Metrics *m, Metric which, uint64_t counts[BUCKETS]) {
+    uint64_t total = 0;
+    for (unsigned i = 0; i < BUCKETS; i += 1) {
+        counts[i] = 0;
+    }
+    for (Shard *s = atomic_load(&m->shards); s != NULL; s = s->next) {
+        for (unsigned i = 0; i < BUCKETS; i += 1) {
+            counts[i] += atomic_load_explicit(&s->counts[which][i], memory_order_relaxed);
+        }
+        total += atomic_load_explicit(&s->total[which], memory_order_relaxed);
+    }
+    return total;
+}
+
+// The quantile() function finds a quantile of a merged histogram
+// Inputs: the counts, their total and q between 0 and 1
+// Outputs: the largest value in the bucket holding the quantile
+
+static uint64_t quantile(uint64_t counts[BUCKETS], uint64_t total, double q) {
+    uint64_t rank = (uint64_t) ceil(q * (double) total);
+    rank = (rank == 0) ? 1 : rank;
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < BUCKETS; i += 1) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return bucket_top(i);
+        }
+    }
+    return 0;
+}
+
+// The metrics_quantile() function finds a quantile over every thread
+// Inputs: the metrics, the operation and q between 0 and 1
+// Outputs: the latency in nanoseconds, 0 if nothing was recorded
+
+uint64_t metrics_quantile(Metrics *m, Metric which, double q) {
+    uint64_t counts[BUCKETS];
+    uint64_t total = merge(m, which, counts);
+    return total ? quantile(counts, total, q) : 0;
+}
+
+// The metrics_write() function writes every histogram in the Prometheus text
+// format: p50, p99 and p999 as a summary, the slowest operation, and how many
+// went over the threshold
+// Inputs: the metrics and the path of the file to write
+// Outputs: true if the file was written
+
+bool metrics_write(Metrics *m, const char *path) {
+    FILE *out = fopen(path, "w");
+    if (out == NULL) {
+        return false;
+    }
+
+    static const double qs[] = { 0.5, 0.99, 0.999 };
+    uint64_t total[METRICS], sum[METRICS], max[METRICS], slow[METRICS];
+    uint64_t counts[METRICS][BUCKETS];
+    for (Metric w = METRIC_READ; w < METRICS; w += 1) {
+        total[w] = merge(m, w, counts[w]);
+        sum[w] = max[w] = slow[w] = 0;
+        for (Shard *s = atomic_load(&m->shards); s != NULL; s = s->next) {
+            uint64_t smax = atomic_load_explicit(&s->max[w], memory_order_relaxed);
+            sum[w] += atomic_load_explicit(&s->sum[w], memory_order_relaxed);
+            slow[w] += atomic_load_explicit(&s->slow[w], memory_order_relaxed);
+            max[w] = (smax > max[w]) ? smax : max[w];
+        }
+    }
+
+    fprintf(out, "# HELP rsa_latency_seconds Latency of each block pow_mod and I/O call.\n"
+                 "# TYPE rsa_latency_seconds summary\n");
+    for (Metric w = METRIC_READ; w < METRICS; w += 1) {
+        for (size_t i = 0; i < sizeof(qs) / sizeof(qs[0]); i += 1) {
+            fprintf(out, "rsa_latency_seconds{op=\"%s\",quantile=\"%g\"} ", labels[w], qs[i]);
+            if (total[w] == 0) {
+                fprintf(out, "NaN\n");
+            } else {
+                fprintf(out, "%.9g\n", quantile(counts[w], total[w], qs[i]) / 1e9);
+            }
+        }
+        fprintf(out, "rsa_latency_seconds_sum{op=\"%s\"} %.9g\n", labels[w], sum[w] / 1e9);
+        fprintf(out, "rsa_latency_seconds_count{op=\"%s\"} %lu\n", labels[w], (unsigned long) total[w]);
+    }
+
+    fprintf(out, "# HELP rsa_latency_max_seconds Slowest single operation.\n"
+                 "# TYPE rsa_latency_max_seconds gauge\n");
+    for (Metric w = METRIC_READ; w < METRICS; w += 1) {
+        fprintf(out, "rsa_latency_max_seconds{op=\"%s\"} %.9g\n", labels[w], max[w] / 1e9);
+    }
+
+    fprintf(out, "# HELP rsa_slow_total Operations slower than rsa_slow_threshold_seconds.\n"
+                 "# TYPE rsa_slow_total counter\n");
+    for (Metric w = METRIC_READ; w < METRICS; w += 1) {
+        fprintf(out, "rsa_slow_total{op=\"%s\"} %lu\n", labels[w], (unsigned long) slow[w]);
+    }
+    fprintf(out, "# HELP rsa_slow_threshold_seconds Latency counted as slow.\n"
+                 "# TYPE rsa_slow_threshold_seconds gauge\n"
+                 "rsa_slow_threshold_seconds %.9g\n",
+        m->threshold / 1e9);
+
+    return fclose(out) == 0;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// What a latency is recorded for: one block's pow_mod, or one read or write call
+typedef enum { METRIC_READ, METRIC_BLOCK, METRIC_WRITE, METRICS } Metric;
+
+typedef struct Metrics Metrics;
+
+// The metrics being recorded, or NULL (the default) to record nothing
+extern Metrics *metrics;
+
+Metrics *metrics_create(uint64_t threshold_ns);
+
+void metrics_delete(Metrics **m);
+
+uint64_t metrics_start(void);
+
+uint64_t metrics_lap(Metric which, uint64_t start);
+
+void metrics_record(Metrics *m, Metric which, uint64_t ns);
+
+uint64_t metrics_quantile(Metrics *m, Metric which, double q);
+
+bool metrics_write(Metrics *m, const char *path);
@@ -0,0 +1,261 @@
+#include "numtheory.h"
+#include "backend.h"
+#include "randstate.h"
+#include "rsa.h"
+
+#include <stdio.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+// This function prints out information about how to properly use the file
+// Inputs: void
+// Outputs: void
+
+void message(void) {
+    fprintf(stderr, "SYNOPSIS\n"
+                    "   Runs every number theory backend on the same inputs, checks that\n"
+                    "   they agree and reports how long each one takes.\n"
+                    "\n"
+                    "USAGE\n"
+                    "   ./ntbench [-hd] [-b bits] [-c count] [-i confidence] [-s seed]\n"
+                    "\n"
+                    "OPTIONS\n"
+                    "   -h              Display program help and usage.\n"
+                    "   -d              Make -c keys of -b bits instead and compare private\n"
+                    "                   exponents modulo the totient and modulo lambda(n).\n"
+                    "   -b bits         Size of the test numbers (default: 1024).\n"
+                    "   -c count        Number of inputs per function (default: 50).\n"
+                    "   -i confidence   Miller-Rabin iterations for is_prime (default: 50).\n"
+                    "   -s seed         Random seed for the inputs (default: time(NULL)).\n");
+    return;
+}
+
+#define OPTIONS "hdb:c:i:s:"
+
+typedef struct {
+    const char *name;
+    void (*gcd)(mpz_t, mpz_t, mpz_t);
+    void (*mod_inverse)(mpz_t, mpz_t, mpz_t);
+    void (*pow_mod)(mpz_t, mpz_t, mpz_t, mpz_t);
+    bool (*is_prime)(mpz_t, uint64_t);
+} Backend;
+
+static const Backend backends[] = {
+    { "native", gcd_native, mod_inverse_native, pow_mod_native, is_prime_native },
+    { "gmp", gcd_gmp, mod_inverse_gmp, pow_mod_gmp, is_prime_gmp },
+    { "fast", gcd_fast, mod_inverse_fast, pow_mod_fast, is_prime_fast },
+};
+
+#define BACKENDS (sizeof(backends) / sizeof(backends[0]))
+
+// Baillie-PSW is timed alongside the is_prime backends, with -i extra rounds
+static const Backend bpsw = { "bpsw", gcd_native, mod_inverse_native, pow_mod_native, is_prime_bpsw };
+
+typedef enum { GCD, MOD_INVERSE, POW_MOD, IS_PRIME, FUNCTIONS } Function;
+
+static const char *names[] = { "gcd", "mod_inverse", "pow_mod", "is_prime" };
+
+// Timed decryptions per key and exponent, and the last row of the histogram of
+// how many bits shorter d gets
+#define REPS     5
+#define MAX_SAVE 8
+
+// Known composites that fool weak tests: Carmichael numbers and strong
+// pseudoprimes to small bases
+static const char *tricky[] = { "561", "1105", "1729", "2047", "3215031751", "2152302898747",
+    "3474749660383", "341550071728321", "3825123056546413051",
+    "318665857834031151167461", "3317044064679887385961981" };
+
+#define TRICKY (sizeof(tricky) / sizeof(tricky[0]))
+
+// This function reads the monotonic clock
+// Inputs: void
+// Outputs: the time in nanoseconds
+
+static uint64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+// This function runs one function of one backend over every input
+// Inputs: the backend, the function, the inputs a, b, m and the count,
+// out = results, confidence for is_prime
+// Outputs: the total time in nanoseconds
+
+static uint64_t run(const Backend *be, Function f, mpz_t *a, mpz_t *b, mpz_t *m, uint64_t count,
+    mpz_t *out, uint64_t iters) {
+    uint64_t start = now();
+    for (uint64_t i = 0; i < count; i += 1) {
+        switch (f) {
+        case GCD: be->gcd(out[i], a[i], b[i]); break;
+        case MOD_INVERSE: be->mod_inverse(out[i], a[i], m[i]); break;
+        case POW_MOD: be->pow_mod(out[i], a[i], b[i], m[i]); break;
+        case IS_PRIME: mpz_set_ui(out[i], be->is_prime(m[i], iters)); break;
+        default: break;
+        }
+    }
+    return now() - start;
+}
+
+// This function makes keys the way keygen does and compares the private
+// exponent modulo the totient, as keys used to have, with the one modulo
+// lambda(n) that rsa_make_priv() makes now: how much shorter d gets and how
+// much faster decryption is
+// Inputs: the key size, the number of keys, confidence for is_prime
+// Outputs: the number of keys that didn't decrypt correctly
+
+static uint64_t exponents(uint64_t bits, uint64_t count, uint64_t iters) {
+    mpz_t p, q, n, e, tot, d_tot, d_lambda, m, c, x;
+    mpz_inits(p, q, n, e, tot, d_tot, d_lambda, m, c, x, NULL);
+    uint64_t saved[MAX_SAVE + 1] = { 0 };
+    uint64_t bits_tot = 0, bits_lambda = 0;
+    uint64_t ns_tot = 0, ns_lambda = 0;
+    uint64_t wrong = 0;
+
+    for (uint64_t i = 0; i < count; i += 1) {
+        rsa_make_pub(p, q, n, e, bits, iters);
+        mpz_sub_ui(tot, p, 1);
+        mpz_sub_ui(x, q, 1);
+        mpz_mul(tot, tot, x);
+        mod_inverse(d_tot, e, tot);
+        rsa_make_priv(d_lambda, e, p, q);
+
+        uint64_t lt = mpz_sizeinbase(d_tot, 2);
+        uint64_t ll = mpz_sizeinbase(d_lambda, 2);
+        bits_tot += lt;
+        bits_lambda += ll;
+        saved[(lt - ll < MAX_SAVE) ? lt - ll : MAX_SAVE] += 1;
+
+        // both exponents must undo e
+        mpz_urandomm(m, state, n);
+        pow_mod(c, m, e, n);
+        for (int r = 0; r < REPS; r += 1) {
+            uint64_t start = now();
+            pow_mod(x, c, d_tot, n);
+            ns_tot += now() - start;
+            wrong += r == 0 && mpz_cmp(x, m) != 0;
+            start = now();
+            pow_mod(x, c, d_lambda, n);
+            ns_lambda += now() - start;
+            wrong += r == 0 && mpz_cmp(x, m) != 0;
+        }
+    }
+
+    printf("%-16s %8s\n", "d bits shorter", "keys");
+    for (int k = 0; k < MAX_SAVE; k += 1) {
+        printf("%-16d %8" PRIu64 "\n", k, saved[k]);
+    }
+    printf("%d%-15s %8" PRIu64 "\n", MAX_SAVE, "+", saved[MAX_SAVE]);
+    printf("mean d bits: totient %.1f, lambda %.1f\n", (double) bits_tot / count,
+        (double) bits_lambda / count);
+    printf("decrypt ns/op: totient %.0f, lambda %.0f, speedup %.3fx\n",
+        (double) ns_tot / (count * REPS), (double) ns_lambda / (count * REPS),
+        ns_lambda ? (double) ns_tot / ns_lambda : 0.0);
+    printf("built with the %s backend, %s\n", numtheory_backend(),
+        wrong ? "WRONG DECRYPTION" : "all decrypt");
+
+    mpz_clears(p, q, n, e, tot, d_tot, d_lambda, m, c, x, NULL);
+    return wrong;
+}
+
+int main(int argc, char **argv) {
+    int option = 0;
+    uint64_t bits = 1024;
+    uint64_t count = 50;
+    uint64_t iters = 50;
+    uint64_t seed = time(NULL);
+    bool keys = false;
+
+    while ((option = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (option) {
+        case 'b': bits = (uint64_t) strtoul(optarg, NULL, 10); break;
+        case 'c': count = (uint64_t) strtoul(optarg, NULL, 10); break;
+        case 'i': iters = (uint64_t) strtoul(optarg, NULL, 10); break;
+        case 's': seed = (uint64_t) strtoul(optarg, NULL, 10); break;
+        case 'd': keys = true; break;
+        case 'h': message(); return 0;
+        default: message(); return 1;
+        }
+    }
+    if (keys && (bits < 16 || count < 1)) {
+        fprintf(stderr, "Need at least 16 bits and 1 key.\n");
+        return 1;
+    } else if (keys) {
+        randstate_init(seed);
+        uint64_t wrong = exponents(bits, count, iters);
+        randstate_clear();
+        return wrong ? 1 : 0;
+    }
+    if (bits < 16 || count < TRICKY) {
+        fprintf(stderr, "Need at least 16 bits and %zu inputs.\n", TRICKY);
+        return 1;
+    }
+
+    randstate_init(seed);
+
+    // a, b are random, m is an odd modulus with its top bit set
+    mpz_t *a = (mpz_t *) calloc(count, sizeof(mpz_t));
+    mpz_t *b = (mpz_t *) calloc(count, sizeof(mpz_t));
+    mpz_t *m = (mpz_t *) calloc(count, sizeof(mpz_t));
+    mpz_t *p = (mpz_t *) calloc(count, sizeof(mpz_t)); // candidates for is_prime
+    mpz_t *expect = (mpz_t *) calloc(count, sizeof(mpz_t));
+    mpz_t *got = (mpz_t *) calloc(count, sizeof(mpz_t));
+    for (uint64_t i = 0; i < count; i += 1) {
+        mpz_inits(a[i], b[i], m[i], p[i], expect[i], got[i], NULL);
+        mpz_urandomb(a[i], state, bits);
+        mpz_urandomb(b[i], state, bits);
+        mpz_urandomb(m[i], state, bits);
+        mpz_setbit(m[i], bits - 1);
+        mpz_setbit(m[i], 0);
+        // a third primes, the rest random odd numbers and known pseudoprimes
+        mpz_urandomb(p[i], state, bits);
+        if (i < TRICKY) {
+            mpz_set_str(p[i], tricky[i], 10);
+        } else if (i % 3 == 0) {
+            mpz_nextprime(p[i], p[i]);
+        } else {
+            mpz_setbit(p[i], 0);
+        }
+    }
+
+    printf("%-12s %-8s %14s %9s %11s\n", "function", "backend", "ns/op", "speedup", "mismatches");
+    uint64_t failures = 0;
+    for (Function f = GCD; f < FUNCTIONS; f += 1) {
+        // GMP is the reference for the exact functions, and a 50 round
+        // mpz_probab_prime_p() for is_prime
+        mpz_t *input = (f == IS_PRIME) ? p : m;
+        run(&backends[1], f, a, b, input, count, expect, 50);
+
+        uint64_t base = 0;
+        for (size_t k = 0; k < BACKENDS + (f == IS_PRIME); k += 1) {
+            const Backend *be = (k < BACKENDS) ? &backends[k] : &bpsw;
+            uint64_t ns = run(be, f, a, b, input, count, got, (be == &bpsw) ? 0 : iters);
+            base = (k == 0) ? ns : base;
+            uint64_t wrong = 0;
+            for (uint64_t i = 0; i < count; i += 1) {
+                wrong += mpz_cmp(got[i], expect[i]) != 0;
+            }
+            failures += wrong;
+            printf("%-12s %-8s %14.0f %8.2fx %11" PRIu64 "\n", names[f], be->name,
+                (double) ns / count, ns ? (double) base / ns : 0.0, wrong);
+        }
+    }
+    printf("built with the %s backend, %s\n", numtheory_backend(), failures ? "MISMATCH" : "all agree");
+
+    for (uint64_t i = 0; i < count; i += 1) {
+        mpz_clears(a[i], b[i], m[i], p[i], expect[i], got[i], NULL);
+    }
+    free(a);
+    free(b);
+    free(m);
+    free(p);
+    free(expect);
+    free(got);
+    randstate_clear();
+    return failures ? 1 : 0;
+}
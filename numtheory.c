@@ -1,16 +1,29 @@
 #include "numtheory.h"
+#include "backend.h"
 #include "randstate.h"
 #include "rsa.h"
 
 #include <stdlib.h>
-
-// The gcd() function finds the greatest common divisor
+#include <string.h>
+
+// The arithmetic backend is picked at build time (make BACKEND=native|gmp|fast).
+// The functions in numtheory.h forward to it, and every backend is always
+// compiled so ntbench can compare them and set_backend() can switch at run time.
+#if defined(BACKEND_GMP)
+#define BACKEND_DEFAULT 1
+#elif defined(BACKEND_FAST)
+#define BACKEND_DEFAULT 2
+#else
+#define BACKEND_DEFAULT 0
+#endif
+
+// The gcd_native() function finds the greatest common divisor
 // of two numbers, a and b
 // Inputs: d = output carrying variable (the gcd of a and b),
 // a and b are the two numbers for which we want to find the gcd
 // Outputs: void
 
-void gcd(mpz_t d, mpz_t a, mpz_t b) {
+void gcd_native(mpz_t d, mpz_t a, mpz_t b) {
     // aa, bb are temporary variables for a and b
     // t is another temporary variable used to avoid
     // altering values inside the loop
@@ -30,13 +43,13 @@ void gcd(mpz_t d, mpz_t a, mpz_t b) {
     return;
 }
 
-// The mod_inverse() function finds the modular inverse i of
+// The mod_inverse_native() function finds the modular inverse i of
 // a (mod n).
 // Inputs: i = output carrying variable, a = the base, n = the
 // modulus that we want to use
 // Outputs: void
 
-void mod_inverse(mpz_t i, mpz_t a, mpz_t n) {
+void mod_inverse_native(mpz_t i, mpz_t a, mpz_t n) {
     // r and r_not are temporary variables containing
     // values of n and a
     mpz_t r, r_not;
@@ -83,14 +96,14 @@ void mod_inverse(mpz_t i, mpz_t a, mpz_t n) {
     }
 }
 
-// The pow_mod() function calculates the power modulus
+// The pow_mod_native() function calculates the power modulus
 // a^b (mod n)
 // Inputs: out = output carrying variable, base = a in the
 // equation above, exponent = b in the equation, modulus = the
 // modulus variable n
 // Outputs: void
 
-void pow_mod(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus) {
+void pow_mod_native(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus) {
     mpz_t v;
     mpz_init_set_ui(v, 1); // v = 1
 
@@ -120,14 +133,14 @@ void pow_mod(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus) {
     return;
 }
 
-// The is_prime() function estimates if a number n is prime over a
+// The is_prime_native() function estimates if a number n is prime over a
 // specified number of iterations (confidence)
 // Inputs: n = the number we are testing, iters = the number of iterations
 // we want to test with - the higher this number, the better the
 // probability of evaluating if the number is prime
 // Outputs: true or false depending on if the number n is prime
 
-bool is_prime(mpz_t n, uint64_t iters) {
+bool is_prime_native(mpz_t n, uint64_t iters) {
     mpz_t var, s, r, first, two, n_minus_one;
     mpz_inits(var, s, r, first, two, n_minus_one, NULL);
 
@@ -165,11 +178,11 @@ bool is_prime(mpz_t n, uint64_t iters) {
         mpz_urandomm(a, state, end);
         mpz_add_ui(a, a, 2);
 
-        pow_mod(y, a, r, n); // y = pow_mod(a, r, n)
+        pow_mod_native(y, a, r, n); // y = pow_mod(a, r, n)
         if (mpz_cmp_ui(y, 1) != 0 && mpz_cmp(y, n_minus_one) != 0) { // if y!=1 and y != n-1
             mpz_set_ui(j, 1);
             while (mpz_cmp(j, s_minus_one) <= 0 && mpz_cmp(y, n_minus_one) != 0) {
-                pow_mod(y, y, two, n); // y = pow_mod(y, 2, n)
+                pow_mod_native(y, y, two, n); // y = pow_mod(y, 2, n)
                 if (mpz_cmp_ui(y, 1) == 0) { // if y = 1 then not prime
                     mpz_clears(end, a, y, j, s_minus_one, temp_r, NULL);
                     mpz_clears(var, s, r, first, two, n_minus_one, NULL);
@@ -189,6 +202,256 @@ bool is_prime(mpz_t n, uint64_t iters) {
     return true;
 }
 
+// The test is_prime() uses, Miller-Rabin unless set_prime_test() says otherwise
+static PrimeTest prime_test = PRIME_MILLER_RABIN;
+
+// The set_prime_test() function picks the primality test behind is_prime()
+// Inputs: PRIME_MILLER_RABIN (iters rounds) or PRIME_BPSW (iters extra rounds)
+// Outputs: void
+
+void set_prime_test(PrimeTest test) {
+    prime_test = test;
+    return;
+}
+
+// The strong_probable_prime() function runs one Miller-Rabin round to base a
+// Inputs: n = odd number over 3, a = the base, n_minus_one = n - 1,
+// r and s with n - 1 = 2^s * r and r odd
+// Outputs: true if n is a strong probable prime to base a
+
+static bool strong_probable_prime(mpz_t n, mpz_t a, mpz_t n_minus_one, mpz_t r, mp_bitcnt_t s) {
+    mpz_t y;
+    mpz_init(y);
+    pow_mod(y, a, r, n);
+    bool prime = mpz_cmp_ui(y, 1) == 0 || mpz_cmp(y, n_minus_one) == 0;
+    for (mp_bitcnt_t j = 1; j < s && !prime; j += 1) {
+        mpz_mul(y, y, y);
+        mpz_mod(y, y, n);
+        if (mpz_cmp_ui(y, 1) == 0) {
+            break; // 1 without passing through n - 1
+        }
+        prime = mpz_cmp(y, n_minus_one) == 0;
+    }
+    mpz_clear(y);
+    return prime;
+}
+
+// The half_mod() function halves x (mod n) for odd n
+// Inputs: x = value in [0, n), n = odd modulus
+// Outputs: void
+
+static void half_mod(mpz_t x, mpz_t n) {
+    if (mpz_odd_p(x)) {
+        mpz_add(x, x, n);
+    }
+    mpz_tdiv_q_2exp(x, x, 1);
+    return;
+}
+
+// The strong_lucas_prime() function runs the strong Lucas test with Selfridge's
+// parameters: the first D of 5, -7, 9, -11, ... with (D/n) = -1, P = 1 and
+// Q = (1 - D) / 4
+// Inputs: n = odd number with no small factors, not a perfect square
+// Outputs: true if n is a strong Lucas probable prime
+
+static bool strong_lucas_prime(mpz_t n) {
+    long D = 5;
+    mpz_t t;
+    mpz_init(t);
+    for (;;) {
+        mpz_set_si(t, D);
+        int j = mpz_jacobi(t, n);
+        if (j == -1) {
+            break;
+        }
+        if (j == 0 && mpz_cmpabs_ui(n, (unsigned long) labs(D)) != 0) {
+            mpz_clear(t);
+            return false; // D shares a factor with n
+        }
+        D = (D > 0) ? -(D + 2) : -(D - 2);
+    }
+    long Q = (1 - D) / 4;
+
+    // n + 1 = 2^s * d with d odd
+    mpz_t d, U, V, Qk, u, v;
+    mpz_inits(d, U, V, Qk, u, v, NULL);
+    mpz_add_ui(d, n, 1);
+    mp_bitcnt_t s = mpz_scan1(d, 0);
+    mpz_tdiv_q_2exp(d, d, s);
+
+    // walk the bits of d: U_k, V_k and Q^k doubled, plus one step when the bit is set
+    mpz_set_ui(U, 1);
+    mpz_set_ui(V, 1); // V_1 = P
+    mpz_set_si(Qk, Q);
+    mpz_mod(Qk, Qk, n);
+    for (mp_bitcnt_t b = mpz_sizeinbase(d, 2) - 1; b-- > 0;) {
+        mpz_mul(U, U, V);
+        mpz_mod(U, U, n); // U_2k = U_k V_k
+        mpz_mul(V, V, V);
+        mpz_submul_ui(V, Qk, 2);
+        mpz_mod(V, V, n); // V_2k = V_k^2 - 2 Q^k
+        mpz_mul(Qk, Qk, Qk);
+        mpz_mod(Qk, Qk, n);
+        if (mpz_tstbit(d, b)) {
+            mpz_add(u, U, V); // U_k+1 = (P U_k + V_k) / 2
+            mpz_mul_si(v, U, D);
+            mpz_add(v, v, V); // V_k+1 = (D U_k + P V_k) / 2
+            mpz_mod(U, u, n);
+            mpz_mod(V, v, n);
+            half_mod(U, n);
+            half_mod(V, n);
+            mpz_mul_si(Qk, Qk, Q);
+            mpz_mod(Qk, Qk, n);
+        }
+    }
+
+    // U_d = 0, or V_(d 2^r) = 0 for some r < s
+    bool prime = mpz_sgn(U) == 0 || mpz_sgn(V) == 0;
+    for (mp_bitcnt_t r = 1; r < s && !prime; r += 1) {
+        mpz_mul(V, V, V);
+        mpz_submul_ui(V, Qk, 2);
+        mpz_mod(V, V, n);
+        mpz_mul(Qk, Qk, Qk);
+        mpz_mod(Qk, Qk, n);
+        prime = mpz_sgn(V) == 0;
+    }
+
+    mpz_clears(t, d, U, V, Qk, u, v, NULL);
+    return prime;
+}
+
+// The is_prime_bpsw() function is the Baillie-PSW test: a strong probable prime
+// test to base 2 and a strong Lucas test. No composite is known to pass both,
+// and there is none below 2^64. Any extra rounds are random Miller-Rabin bases.
+// Inputs: n = the number we are testing, rounds = extra Miller-Rabin rounds
+// Outputs: true or false depending on if the number n is prime
+
+bool is_prime_bpsw(mpz_t n, uint64_t rounds) {
+    static const unsigned small[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+        59, 61, 67, 71, 73, 79, 83, 89, 97 };
+    if (mpz_cmp_ui(n, 2) < 0) {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(small) / sizeof(small[0]); i += 1) {
+        if (mpz_cmp_ui(n, small[i]) == 0) {
+            return true;
+        }
+        if (mpz_divisible_ui_p(n, small[i])) {
+            return false;
+        }
+    }
+    if (mpz_cmp_ui(n, 101 * 101) < 0) {
+        return true; // no factor up to sqrt(n)
+    }
+
+    mpz_t n_minus_one, r, a, end;
+    mpz_inits(n_minus_one, r, a, end, NULL);
+    mpz_sub_ui(n_minus_one, n, 1);
+    mp_bitcnt_t s = mpz_scan1(n_minus_one, 0);
+    mpz_tdiv_q_2exp(r, n_minus_one, s);
+    mpz_set_ui(a, 2);
+
+    // a square never finds a D with (D/n) = -1, so rule it out first
+    bool prime = strong_probable_prime(n, a, n_minus_one, r, s) && !mpz_perfect_square_p(n)
+                 && strong_lucas_prime(n);
+
+    mpz_sub_ui(end, n, 3);
+    for (uint64_t i = 0; i < rounds && prime; i += 1) {
+        mpz_urandomm(a, state, end);
+        mpz_add_ui(a, a, 2); // a in [2, n - 2]
+        prime = strong_probable_prime(n, a, n_minus_one, r, s);
+    }
+
+    mpz_clears(n_minus_one, r, a, end, NULL);
+    return prime;
+}
+
+// One arithmetic backend
+typedef struct {
+    const char *name;
+    void (*gcd)(mpz_t, mpz_t, mpz_t);
+    void (*mod_inverse)(mpz_t, mpz_t, mpz_t);
+    void (*pow_mod)(mpz_t, mpz_t, mpz_t, mpz_t);
+    bool (*is_prime)(mpz_t, uint64_t);
+} Arithmetic;
+
+static const Arithmetic arithmetics[] = {
+    { "native", gcd_native, mod_inverse_native, pow_mod_native, is_prime_native },
+    { "gmp", gcd_gmp, mod_inverse_gmp, pow_mod_gmp, is_prime_gmp },
+    { "fast", gcd_fast, mod_inverse_fast, pow_mod_fast, is_prime_fast },
+};
+
+#define ARITHMETICS (sizeof(arithmetics) / sizeof(arithmetics[0]))
+
+static const Arithmetic *backend = &arithmetics[BACKEND_DEFAULT];
+
+// The set_backend() function switches every numtheory.h function to another
+// backend. They all give the same results, so this only changes the speed.
+// Inputs: "native", "gmp" or "fast"
+// Outputs: true if there is a backend by that name
+
+bool set_backend(const char *name) {
+    for (size_t i = 0; i < ARITHMETICS; i += 1) {
+        if (strcmp(arithmetics[i].name, name) == 0) {
+            backend = &arithmetics[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+// The gcd() function finds the greatest common divisor of a and b with the
+// backend in use
+// Inputs: d = output carrying variable, a and b
+// Outputs: void
+
+void gcd(mpz_t d, mpz_t a, mpz_t b) {
+    backend->gcd(d, a, b);
+    return;
+}
+
+// The mod_inverse() function finds the inverse i of a (mod n), or 0 if there is
+// none, with the backend in use
+// Inputs: i = output carrying variable, a = the base, n = the modulus
+// Outputs: void
+
+void mod_inverse(mpz_t i, mpz_t a, mpz_t n) {
+    backend->mod_inverse(i, a, n);
+    return;
+}
+
+// The pow_mod() function calculates base^exponent (mod modulus) with the
+// backend in use
+// Inputs: out = output carrying variable, base, exponent and modulus
+// Outputs: void
+
+void pow_mod(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus) {
+    backend->pow_mod(out, base, exponent, modulus);
+    return;
+}
+
+// The is_prime() function estimates if n is prime with the backend in use, or
+// with Baillie-PSW if set_prime_test() chose it
+// Inputs: n = the number we are testing, iters = the number of iterations
+// (extra rounds after Baillie-PSW)
+// Outputs: true or false depending on if the number n is prime
+
+bool is_prime(mpz_t n, uint64_t iters) {
+    if (prime_test == PRIME_BPSW) {
+        return is_prime_bpsw(n, iters);
+    }
+    return backend->is_prime(n, iters);
+}
+
+// The numtheory_backend() function names the backend in use, the one chosen at
+// build time unless set_backend() changed it
+// Inputs: void
+// Outputs: "native", "gmp" or "fast"
+
+const char *numtheory_backend(void) {
+    return backend->name;
+}
+
 // The make_prime() function finds a random prime number that is at least
 // the specified number of bits long.
 // Inputs: p = output carrying variable (the prime number that we find)
@@ -5,6 +5,11 @@
 #include <stdio.h>
 #include <gmp.h>
 
+// Which test is_prime() uses
+typedef enum { PRIME_MILLER_RABIN, PRIME_BPSW } PrimeTest;
+
+void set_prime_test(PrimeTest test);
+
 void gcd(mpz_t d, mpz_t a, mpz_t b);
 
 void mod_inverse(mpz_t i, mpz_t a, mpz_t n);
@@ -13,4 +18,10 @@ void pow_mod(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus);
 
 bool is_prime(mpz_t n, uint64_t iters);
 
+bool is_prime_bpsw(mpz_t n, uint64_t rounds);
+
 void make_prime(mpz_t p, uint64_t bits, uint64_t iters);
+
+const char *numtheory_backend(void);
+
+bool set_backend(const char *name);
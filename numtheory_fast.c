@@ -0,0 +1,228 @@
+// The fast backend: the same algorithms as numtheory.c, tuned. pow_mod uses a
+// sliding window over the exponent instead of one bit at a time, is_prime trial
+// divides by small primes before any Miller-Rabin round, and the Euclidean
+// loops swap their variables instead of copying them.
+#include "backend.h"
+#include "randstate.h"
+
+#include <stdlib.h>
+
+static const unsigned small_primes[] = {
+    3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61, 67, 71, 73, 79, 83, 89, 97,
+    101, 103, 107, 109, 113, 127, 131, 137, 139, 149, 151, 157, 163, 167, 173, 179, 181, 191,
+    193, 197, 199, 211, 223, 227, 229, 233, 239, 241, 251, 257, 263, 269, 271, 277, 281, 283,
+    293, 307, 311, 313, 317, 331, 337, 347, 349, 353, 359, 367, 373, 379, 383, 389, 397, 401,
+    409, 419, 421, 431, 433, 439, 443, 449, 457, 461, 463, 467, 479, 487, 491, 499, 503, 509,
+    521, 523, 541, 547, 557, 563, 569, 571, 577, 587, 593, 599, 601, 607, 613, 617, 619, 631,
+    641, 643, 647, 653, 659, 661, 673, 677, 683, 691, 701, 709, 719, 727, 733, 739, 743, 751,
+    757, 761, 769, 773, 787, 797, 809, 811, 821, 823, 827, 829, 839, 853, 857, 859, 863, 877,
+    881, 883, 887, 907, 911, 919, 929, 937, 941, 947, 953, 967, 971, 977, 983, 991, 997,
+};
+
+#define SMALL_PRIMES (sizeof(small_primes) / sizeof(small_primes[0]))
+
+// The gcd_fast() function finds the greatest common divisor of a and b
+// Inputs: d = output carrying variable, a and b
+// Outputs: void
+
+void gcd_fast(mpz_t d, mpz_t a, mpz_t b) {
+    mpz_t aa, bb;
+    mpz_init_set(aa, a);
+    mpz_init_set(bb, b);
+    while (mpz_sgn(bb) != 0) {
+        mpz_tdiv_r(aa, aa, bb); // a = a (mod b)
+        mpz_swap(aa, bb); // a, b = b, a (mod b)
+    }
+    mpz_abs(d, aa);
+    mpz_clears(aa, bb, NULL);
+    return;
+}
+
+// The mod_inverse_fast() function finds the inverse i of a (mod n) with the
+// extended Euclidean algorithm
+// Inputs: i = output carrying variable, a = the base, n = the modulus
+// Outputs: void (i is 0 if there is no inverse)
+
+void mod_inverse_fast(mpz_t i, mpz_t a, mpz_t n) {
+    mpz_t r, r_not, t, t_not, q, tmp;
+    mpz_init_set(r, n);
+    mpz_init_set(r_not, a);
+    mpz_init_set_ui(t, 0);
+    mpz_init_set_ui(t_not, 1);
+    mpz_inits(q, tmp, NULL);
+
+    while (mpz_sgn(r_not) != 0) {
+        mpz_fdiv_qr(q, tmp, r, r_not); // q, tmp = r // r_not, r % r_not
+        mpz_swap(r, r_not);
+        mpz_swap(r_not, tmp); // r, r_not = r_not, r - q * r_not
+
+        mpz_submul(t, q, t_not);
+        mpz_swap(t, t_not); // t, t_not = t_not, t - q * t_not
+    }
+
+    if (mpz_cmp_ui(r, 1) > 0) {
+        mpz_set_ui(i, 0);
+    } else if (mpz_sgn(t) < 0) {
+        mpz_add(i, t, n);
+    } else {
+        mpz_set(i, t);
+    }
+    mpz_clears(r, r_not, t, t_not, q, tmp, NULL);
+    return;
+}
+
+// The window_width() function picks the sliding window width that needs the
+// fewest multiplications for an exponent of the given size
+// Inputs: the number of bits in the exponent
+// Outputs: the width, 1 to 6
+
+static unsigned window_width(size_t bits) {
+    if (bits <= 8) {
+        return 1;
+    } else if (bits <= 24) {
+        return 2;
+    } else if (bits <= 80) {
+        return 3;
+    } else if (bits <= 240) {
+        return 4;
+    } else if (bits <= 672) {
+        return 5;
+    }
+    return 6;
+}
+
+// A fixed window width from set_window_width(), or 0 to pick by size
+static unsigned window_override = 0;
+
+// The set_window_width() function fixes the sliding window width pow_mod_fast()
+// uses, for hosts where another width than window_width() picks is faster
+// Inputs: the width, 1 to 8, or 0 to pick it by exponent size again
+// Outputs: void
+
+void set_window_width(unsigned width) {
+    window_override = (width > 8) ? 8 : width;
+    return;
+}
+
+// The pow_mod_fast() function calculates base^exponent (mod modulus) with a
+// sliding window: the odd powers base^1, base^3, ... base^(2^w - 1) are made up
+// front, then each run of up to w exponent bits ending in a 1 costs one multiply
+// Inputs: out = output carrying variable, base, exponent and modulus
+// Outputs: void
+
+void pow_mod_fast(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus) {
+    if (mpz_sgn(exponent) == 0) {
+        mpz_set_ui(out, 1); // same as pow_mod_native()
+        return;
+    }
+    long bits = (long) mpz_sizeinbase(exponent, 2);
+    unsigned w = window_override ? window_override : window_width((size_t) bits);
+    size_t count = (size_t) 1 << (w - 1);
+
+    // odd[j] = base^(2j + 1) (mod modulus)
+    mpz_t *odd = (mpz_t *) calloc(count, sizeof(mpz_t));
+    mpz_t v, sq, t;
+    mpz_inits(v, sq, t, NULL);
+    mpz_init(odd[0]);
+    mpz_mod(odd[0], base, modulus);
+    mpz_mul(t, odd[0], odd[0]);
+    mpz_mod(sq, t, modulus);
+    for (size_t j = 1; j < count; j += 1) {
+        mpz_init(odd[j]);
+        mpz_mul(t, odd[j - 1], sq);
+        mpz_mod(odd[j], t, modulus);
+    }
+
+    mpz_set_ui(v, 1);
+    long i = bits - 1;
+    while (i >= 0) {
+        if (!mpz_tstbit(exponent, (mp_bitcnt_t) i)) {
+            mpz_mul(t, v, v);
+            mpz_mod(v, t, modulus);
+            i -= 1;
+            continue;
+        }
+        // the window runs from bit i down to the lowest set bit within w bits
+        long l = (i - (long) w + 1 > 0) ? i - (long) w + 1 : 0;
+        while (!mpz_tstbit(exponent, (mp_bitcnt_t) l)) {
+            l += 1;
+        }
+        size_t value = 0;
+        for (long b = i; b >= l; b -= 1) {
+            value = (value << 1) | (size_t) mpz_tstbit(exponent, (mp_bitcnt_t) b);
+            mpz_mul(t, v, v);
+            mpz_mod(v, t, modulus);
+        }
+        mpz_mul(t, v, odd[value / 2]);
+        mpz_mod(v, t, modulus);
+        i = l - 1;
+    }
+
+    mpz_set(out, v);
+    for (size_t j = 0; j < count; j += 1) {
+        mpz_clear(odd[j]);
+    }
+    free(odd);
+    mpz_clears(v, sq, t, NULL);
+    return;
+}
+
+// The is_prime_fast() function estimates if n is prime. Small factors are
+// found by division, anything left gets the same Miller-Rabin rounds as
+// is_prime_native().
+// Inputs: n = the number we are testing, iters = the number of iterations
+// Outputs: true or false depending on if the number n is prime
+
+bool is_prime_fast(mpz_t n, uint64_t iters) {
+    if (mpz_cmp_ui(n, 2) < 0) {
+        return false;
+    }
+    if (mpz_cmp_ui(n, 2) == 0) {
+        return true;
+    }
+    if (mpz_even_p(n)) {
+        return false;
+    }
+    for (size_t j = 0; j < SMALL_PRIMES; j += 1) {
+        if (mpz_cmp_ui(n, small_primes[j]) == 0) {
+            return true;
+        }
+        if (mpz_divisible_ui_p(n, small_primes[j])) {
+            return false;
+        }
+    }
+    unsigned largest = small_primes[SMALL_PRIMES - 1];
+    if (mpz_cmp_ui(n, (unsigned long) largest * largest) < 0) {
+        return true; // no factor up to sqrt(n)
+    }
+
+    // n - 1 = 2^s * r with r odd
+    mpz_t n_minus_one, r, a, y, end;
+    mpz_inits(n_minus_one, r, a, y, end, NULL);
+    mpz_sub_ui(n_minus_one, n, 1);
+    mp_bitcnt_t s = mpz_scan1(n_minus_one, 0);
+    mpz_tdiv_q_2exp(r, n_minus_one, s);
+    mpz_sub_ui(end, n, 3);
+
+    bool prime = true;
+    for (uint64_t i = 1; i < iters && prime; i += 1) {
+        mpz_urandomm(a, state, end);
+        mpz_add_ui(a, a, 2); // a in [2, n - 2]
+
+        pow_mod_fast(y, a, r, n);
+        if (mpz_cmp_ui(y, 1) == 0 || mpz_cmp(y, n_minus_one) == 0) {
+            continue;
+        }
+        for (mp_bitcnt_t j = 1; j < s && mpz_cmp(y, n_minus_one) != 0; j += 1) {
+            mpz_mul(y, y, y);
+            mpz_mod(y, y, n);
+            if (mpz_cmp_ui(y, 1) == 0) {
+                break;
+            }
+        }
+        prime = mpz_cmp(y, n_minus_one) == 0;
+    }
+
+    mpz_clears(n_minus_one, r, a, y, end, NULL);
+    return prime;
+}
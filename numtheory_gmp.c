@@ -0,0 +1,41 @@
+// The gmp backend: the number theory functions straight from GMP, as the
+// reference the homegrown backends are measured against
+#include "backend.h"
+
+// The gcd_gmp() function finds the greatest common divisor of a and b
+// Inputs: d = output carrying variable, a and b
+// Outputs: void
+
+void gcd_gmp(mpz_t d, mpz_t a, mpz_t b) {
+    mpz_gcd(d, a, b);
+    return;
+}
+
+// The mod_inverse_gmp() function finds the inverse i of a (mod n)
+// Inputs: i = output carrying variable, a = the base, n = the modulus
+// Outputs: void (i is 0 if there is no inverse, like mod_inverse_native())
+
+void mod_inverse_gmp(mpz_t i, mpz_t a, mpz_t n) {
+    if (mpz_invert(i, a, n) == 0) {
+        mpz_set_ui(i, 0);
+    }
+    return;
+}
+
+// The pow_mod_gmp() function calculates base^exponent (mod modulus)
+// Inputs: out = output carrying variable, base, exponent and modulus
+// Outputs: void
+
+void pow_mod_gmp(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus) {
+    mpz_powm(out, base, exponent, modulus);
+    return;
+}
+
+// The is_prime_gmp() function estimates if n is prime with GMP's own trial
+// division, Baillie-PSW and Miller-Rabin rounds
+// Inputs: n = the number we are testing, iters = the number of iterations
+// Outputs: true or false depending on if the number n is prime
+
+bool is_prime_gmp(mpz_t n, uint64_t iters) {
+    return mpz_probab_prime_p(n, (int) iters) > 0;
+}
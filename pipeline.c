@@ -0,0 +1,348 @@
+// A three stage pipeline for streams of blocks: a reader thread reads batches
+// of blocks, compute workers exponentiate them, and the calling thread writes
+// them out, so reading and writing overlap with the arithmetic. The stages are
+// joined by bounded single-producer, single-consumer queues of batches. With
+// more than one worker the reader hands batches out round-robin and the writer
+// collects them in the same order, so every queue keeps one producer and one
+// consumer and the output stays in input order. Written batches go back to the
+// reader on a free queue, so nothing is allocated once the pipeline runs.
+//
+// A stage that finds its queue empty or full spins briefly and then sleeps on
+// a futex on the queue's index. It raises a flag first, and the other side only
+// makes the wake syscall after moving the index if it sees the flag, so a
+// handoff to a stage that isn't asleep costs no syscall.
+#include "pipeline.h"
+#include "metrics.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#define SPINS 100
+
+static size_t batch_size = 16; // blocks per batch
+static size_t queue_depth = 4; // batches per queue
+static size_t compute_workers = 1; // 0 runs every stage in the caller
+
+// A batch of blocks on their way through, or the end of the stream
+typedef struct {
+    mpz_t *in;
+    mpz_t *out;
+    size_t count;
+    bool end;
+} Batch;
+
+// A bounded single-producer, single-consumer queue of batches. head and tail
+// count pops and pushes, and only their difference matters.
+typedef struct {
+    Batch **slots;
+    uint32_t mask;
+    uint32_t head; // written by the consumer
+    uint32_t tail; // written by the producer
+    uint32_t head_waiting; // the producer sleeps until head moves
+    uint32_t tail_waiting; // the consumer sleeps until tail moves
+} Queue;
+
+typedef struct {
+    PipelineRead read;
+    PipelineCompute compute;
+    PipelineWrite write;
+    void *ctx;
+    size_t workers;
+    Queue free; // empty batches, from the writer back to the reader
+    Queue *todo; // read batches, from the reader to each worker
+    Queue *done; // computed batches, from each worker to the writer
+} Pipeline;
+
+// What one worker thread gets
+typedef struct {
+    Pipeline *p;
+    size_t id;
+} Worker;
+
+// The pipeline_set() function sets the batch size, the queue depth and the
+// number of compute workers. 0 workers runs the stages one after another in
+// the caller, with no threads.
+// Inputs: blocks per batch, batches per queue, number of compute workers
+// Outputs: void
+
+void pipeline_set(size_t batch, size_t depth, size_t workers) {
+    batch_size = (batch < 1) ? 1 : batch;
+    queue_depth = (depth < 1) ? 1 : depth;
+    compute_workers = workers;
+    return;
+}
+
+// The queue_init() function makes an empty queue holding at least depth batches
+// Inputs: the queue and its depth
+// Outputs: void
+
+static void queue_init(Queue *q, size_t depth) {
+    uint32_t size = 1;
+    while (size < depth) {
+        size <<= 1;
+    }
+    q->slots = (Batch **) calloc(size, sizeof(Batch *));
+    q->mask = size - 1;
+    q->head = q->tail = 0;
+    q->head_waiting = q->tail_waiting = 0;
+    return;
+}
+
+// The await() function waits until a queue index moves on from seen. The flag
+// is raised before the index is checked a last time, and wake() moves the index
+// before checking the flag, so one of them always sees the other.
+// Inputs: the index, its waiting flag and the value it had
+// Outputs: void
+
+static void await(uint32_t *index, uint32_t *waiting, uint32_t seen) {
+    for (int spin = 0; spin < SPINS; spin += 1) {
+        if (__atomic_load_n(index, __ATOMIC_ACQUIRE) != seen) {
+            return;
+        }
+    }
+    __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(index, __ATOMIC_SEQ_CST) == seen) {
+        // returns at once if wake() already moved the index
+        syscall(SYS_futex, index, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+    }
+    return;
+}
+
+// The wake() function wakes the stage waiting on a queue index, if there is one
+// Inputs: the index, which was just moved, and its waiting flag
+// Outputs: void
+
+static void wake(uint32_t *index, uint32_t *waiting) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiting, __ATOMIC_RELAXED) != 0
+        && __atomic_exchange_n(waiting, 0, __ATOMIC_SEQ_CST) != 0) {
+        syscall(SYS_futex, index, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+    return;
+}
+
+// The push() function adds a batch to a queue, waiting while it is full
+// Inputs: the queue and the batch
+// Outputs: void
+
+static void push(Queue *q, Batch *b) {
+    uint32_t tail = q->tail;
+    uint32_t head;
+    while (tail - (head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE)) > q->mask) {
+        await(&q->head, &q->head_waiting, head);
+    }
+    q->slots[tail & q->mask] = b;
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+    wake(&q->tail, &q->tail_waiting);
+    return;
+}
+
+// The pop() function takes the oldest batch off a queue, waiting while it is empty
+// Inputs: the queue
+// Outputs: the batch
+
+static Batch *pop(Queue *q) {
+    uint32_t head = q->head;
+    uint32_t tail;
+    while ((tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE)) == head) {
+        await(&q->tail, &q->tail_waiting, tail);
+    }
+    Batch *b = q->slots[head & q->mask];
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    wake(&q->head, &q->head_waiting);
+    return b;
+}
+
+// The reader() function is the reader stage: it fills free batches and deals
+// them out round-robin, then sends each worker the end of the stream
+// Inputs: the pipeline
+// Outputs: NULL
+
+static void *reader(void *arg) {
+    Pipeline *p = (Pipeline *) arg;
+    size_t w = 0;
+    bool more = true;
+    Batch *b = NULL;
+    while (more) {
+        b = pop(&p->free);
+        b->count = 0;
+        b->end = false;
+        uint64_t t = metrics_start();
+        while (b->count < batch_size && (more = p->read(p->ctx, b->in[b->count]))) {
+            b->count += 1;
+            t = metrics_lap(METRIC_READ, t);
+        }
+        if (b->count == 0) {
+            break; // keep the batch for the first end marker
+        }
+        push(&p->todo[w], b);
+        w = (w + 1) % p->workers;
+        b = NULL;
+    }
+    // the markers go out in the writer's order, right after the last data
+    for (size_t i = 0; i < p->workers; i += 1) {
+        b = (b != NULL) ? b : pop(&p->free);
+        b->count = 0;
+        b->end = true;
+        push(&p->todo[w], b);
+        w = (w + 1) % p->workers;
+        b = NULL;
+    }
+    return NULL;
+}
+
+// The worker() function is one compute worker: it computes its batches until
+// the end marker, which it passes on
+// Inputs: the worker
+// Outputs: NULL
+
+static void *worker(void *arg) {
+    Worker *me = (Worker *) arg;
+    Pipeline *p = me->p;
+    bool end;
+    do {
+        Batch *b = pop(&p->todo[me->id]);
+        uint64_t t = metrics_start();
+        for (size_t i = 0; i < b->count; i += 1) {
+            p->compute(p->ctx, b->out[i], b->in[i]);
+            t = metrics_lap(METRIC_BLOCK, t);
+        }
+        end = b->end; // the batch belongs to the writer once pushed
+        push(&p->done[me->id], b);
+    } while (!end);
+    return NULL;
+}
+
+// The writer() function is the writer stage: it collects batches round-robin,
+// writes them, and returns them to the reader until every worker has ended
+// Inputs: the pipeline
+// Outputs: void
+
+static void writer(Pipeline *p) {
+    size_t w = 0;
+    size_t ends = 0;
+    while (ends < p->workers) {
+        Batch *b = pop(&p->done[w]);
+        w = (w + 1) % p->workers;
+        ends += b->end ? 1 : 0;
+        uint64_t t = metrics_start();
+        for (size_t i = 0; i < b->count; i += 1) {
+            p->write(p->ctx, b->out[i]);
+            t = metrics_lap(METRIC_WRITE, t);
+        }
+        push(&p->free, b);
+    }
+    return;
+}
+
+// The serial() function runs the stages one block at a time in the caller
+// Inputs: the stages and their context
+// Outputs: void
+
+static void serial(PipelineRead read, PipelineCompute compute, PipelineWrite write, void *ctx) {
+    mpz_t in, out;
+    mpz_inits(in, out, NULL);
+    uint64_t t = metrics_start();
+    while (read(ctx, in)) {
+        t = metrics_lap(METRIC_READ, t);
+        compute(ctx, out, in);
+        t = metrics_lap(METRIC_BLOCK, t);
+        write(ctx, out);
+        t = metrics_lap(METRIC_WRITE, t);
+    }
+    mpz_clears(in, out, NULL);
+    return;
+}
+
+// The pipeline_run() function reads, computes and writes every block of a
+// stream, in order, with the stages running at the same time. It falls back to
+// running them in turn if there are no workers or threads can't be started.
+// Inputs: the stages and their context, which the reader, the workers and the
+// writer share, so each stage should only touch its own part of it
+// Outputs: void
+
+void pipeline_run(PipelineRead read, PipelineCompute compute, PipelineWrite write, void *ctx) {
+    if (compute_workers == 0) {
+        serial(read, compute, write, ctx);
+        return;
+    }
+    Pipeline p = { .read = read, .compute = compute, .write = write, .ctx = ctx };
+    p.workers = compute_workers;
+    p.todo = (Queue *) calloc(p.workers, sizeof(Queue));
+    p.done = (Queue *) calloc(p.workers, sizeof(Queue));
+    for (size_t i = 0; i < p.workers; i += 1) {
+        queue_init(&p.todo[i], queue_depth);
+        queue_init(&p.done[i], queue_depth);
+    }
+    // enough batches to fill every worker's queue, plus one being read and one
+    // being written; the free queue can hold them all so the writer never waits
+    size_t count = p.workers * queue_depth + 2;
+    queue_init(&p.free, count);
+    Batch *batches = (Batch *) calloc(count, sizeof(Batch));
+    for (size_t i = 0; i < count; i += 1) {
+        batches[i].in = (mpz_t *) malloc(batch_size * sizeof(mpz_t));
+        batches[i].out = (mpz_t *) malloc(batch_size * sizeof(mpz_t));
+        for (size_t j = 0; j < batch_size; j += 1) {
+            mpz_inits(batches[i].in[j], batches[i].out[j], NULL);
+        }
+        push(&p.free, &batches[i]);
+    }
+
+    Worker *workers = (Worker *) calloc(p.workers, sizeof(Worker));
+    pthread_t *tids = (pthread_t *) calloc(p.workers, sizeof(pthread_t));
+    pthread_t rid;
+    size_t started = 0;
+    while (started < p.workers) {
+        workers[started].p = &p;
+        workers[started].id = started;
+        if (pthread_create(&tids[started], NULL, worker, &workers[started]) != 0) {
+            break;
+        }
+        started += 1;
+    }
+    bool threaded = started == p.workers && pthread_create(&rid, NULL, reader, &p) == 0;
+    if (threaded) {
+        writer(&p);
+        pthread_join(rid, NULL);
+    } else {
+        // stop the workers that did start, then do it all here
+        for (size_t i = 0; i < started; i += 1) {
+            Batch *b = pop(&p.free);
+            b->count = 0;
+            b->end = true;
+            push(&p.todo[i], b);
+            push(&p.free, pop(&p.done[i]));
+        }
+    }
+    for (size_t i = 0; i < started; i += 1) {
+        pthread_join(tids[i], NULL);
+    }
+    if (!threaded) {
+        serial(read, compute, write, ctx);
+    }
+
+    for (size_t i = 0; i < count; i += 1) {
+        for (size_t j = 0; j < batch_size; j += 1) {
+            mpz_clears(batches[i].in[j], batches[i].out[j], NULL);
+        }
+        free(batches[i].in);
+        free(batches[i].out);
+    }
+    for (size_t i = 0; i < p.workers; i += 1) {
+        free(p.todo[i].slots);
+        free(p.done[i].slots);
+    }
+    free(p.free.slots);
+    free(p.todo);
+    free(p.done);
+    free(batches);
+    free(workers);
+    free(tids);
+    return;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <gmp.h>
+
+// The three stages of a pipeline: read the next block (false at the end),
+// compute a block, and write a computed block
+typedef bool (*PipelineRead)(void *ctx, mpz_t block);
+typedef void (*PipelineCompute)(void *ctx, mpz_t out, mpz_t in);
+typedef void (*PipelineWrite)(void *ctx, mpz_t block);
+
+void pipeline_set(size_t batch, size_t depth, size_t workers);
+
+void pipeline_run(PipelineRead read, PipelineCompute compute, PipelineWrite write, void *ctx);
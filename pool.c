@@ -0,0 +1,206 @@
+// A pool of primes made ahead of time by keygen --fill-pool, so that keygen
+// itself only has to pick two. The pool is a text file with one prime per line,
+// "<bits> <prime in hex>", where bits is what was passed to make_prime(). Every
+// access holds an flock() on the file, and a prime is removed as it is taken,
+// so no prime is ever handed out twice.
+#include "pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+// The pool_open() function opens and locks the pool file. The file is created
+// private to the user, since the primes are the secret half of future keys.
+// Inputs: the path, whether to create it, the lock (LOCK_SH or LOCK_EX)
+// Outputs: the open file, or NULL
+
+static FILE *pool_open(const char *path, bool create, int lock) {
+    int fd = open(path, create ? O_RDWR | O_CREAT : O_RDWR, 0600);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (flock(fd, lock) != 0) {
+        close(fd);
+        return NULL;
+    }
+    FILE *pool = fdopen(fd, "r+");
+    if (pool == NULL) {
+        close(fd);
+    }
+    return pool;
+}
+
+// The pool_load() function reads the whole pool into memory
+// Inputs: the open pool and where to put its size
+// Outputs: the NUL terminated contents, to be freed by the caller
+
+static char *pool_load(FILE *pool, size_t *size) {
+    fseek(pool, 0, SEEK_END);
+    long end = ftell(pool);
+    *size = (end > 0) ? (size_t) end : 0;
+    char *text = (char *) malloc(*size + 1);
+    rewind(pool);
+    *size = fread(text, sizeof(char), *size, pool);
+    text[*size] = '\0';
+    return text;
+}
+
+// The pool_close() function unlocks and closes the pool
+// Inputs: the open pool
+// Outputs: void
+
+static void pool_close(FILE *pool) {
+    fflush(pool);
+    flock(fileno(pool), LOCK_UN);
+    fclose(pool);
+    return;
+}
+
+// The pool_add() function appends a prime to the pool
+// Inputs: the pool path, the size it was made with and the prime
+// Outputs: true if it was written
+
+bool pool_add(const char *path, uint64_t bits, mpz_t p) {
+    FILE *pool = pool_open(path, true, LOCK_EX);
+    if (pool == NULL) {
+        return false;
+    }
+    fseek(pool, 0, SEEK_END);
+    bool ok = gmp_fprintf(pool, "%lu %Zx\n", (unsigned long) bits, p) > 0;
+    pool_close(pool);
+    return ok;
+}
+
+// The pool_take() function removes the first prime of the given size from the pool
+// Inputs: the pool path, the size and p = output carrying variable
+// Outputs: true if a prime was taken, false if there was none
+
+bool pool_take(const char *path, uint64_t bits, mpz_t p) {
+    FILE *pool = pool_open(path, false, LOCK_EX);
+    if (pool == NULL) {
+        return false;
+    }
+
+    size_t size;
+    char *text = pool_load(pool, &size);
+    bool found = false;
+    char *line = text;
+    while (!found && line < text + size) {
+        char *end = strchr(line, '\n');
+        end = (end == NULL) ? text + size : end + 1;
+        char *hex;
+        if (strtoull(line, &hex, 10) == bits) {
+            // end the string at this line for mpz_set_str(), which skips the space
+            char saved = *(end - 1);
+            *(end - 1) = (saved == '\n') ? '\0' : saved;
+            found = mpz_set_str(p, hex, 16) == 0;
+            *(end - 1) = saved;
+        }
+        if (found) {
+            // close the gap and shorten the file
+            memmove(line, end, (size_t) (text + size - end));
+            size -= (size_t) (end - line);
+            rewind(pool);
+            fwrite(text, sizeof(char), size, pool);
+            fflush(pool);
+            found = ftruncate(fileno(pool), (off_t) size) == 0;
+        }
+        line = end;
+    }
+
+    free(text);
+    pool_close(pool);
+    return found;
+}
+
+// The pool_take_pair() function takes the two primes for an nbits key, split
+// evenly. If only one is there it goes back, so the caller can make both.
+// Inputs: the pool path, the key size and p, q = output carrying variables
+// Outputs: true if both primes came from the pool
+
+bool pool_take_pair(const char *path, uint64_t nbits, mpz_t p, mpz_t q) {
+    uint64_t pbits = nbits / 2;
+    uint64_t qbits = nbits - pbits;
+    if (!pool_take(path, pbits, p)) {
+        return false;
+    }
+    if (!pool_take(path, qbits, q) || mpz_cmp(p, q) == 0) {
+        pool_add(path, pbits, p);
+        return false;
+    }
+    return true;
+}
+
+// The pool_count() function counts the primes of one size in the pool
+// Inputs: the pool path and the size (0 counts every size)
+// Outputs: the number of primes
+
+uint64_t pool_count(const char *path, uint64_t bits) {
+    FILE *pool = pool_open(path, false, LOCK_SH);
+    if (pool == NULL) {
+        return 0;
+    }
+    size_t size;
+    char *text = pool_load(pool, &size);
+    pool_close(pool);
+
+    uint64_t count = 0;
+    for (char *line = text; line < text + size;) {
+        char *end = strchr(line, '\n');
+        end = (end == NULL) ? text + size : end + 1;
+        if (bits == 0 || strtoull(line, NULL, 10) == bits) {
+            count += 1;
+        }
+        line = end;
+    }
+    free(text);
+    return count;
+}
+
+// The pool_status() function prints how many primes of each size are in the pool
+// Inputs: the pool path and where to print
+// Outputs: void
+
+void pool_status(const char *path, FILE *outfile) {
+    FILE *pool = pool_open(path, false, LOCK_SH);
+    if (pool == NULL) {
+        fprintf(outfile, "%s: empty\n", path);
+        return;
+    }
+    size_t size;
+    char *text = pool_load(pool, &size);
+    pool_close(pool);
+
+    // sizes are few, so a small list of (bits, count) is plenty
+    uint64_t sizes[64][2];
+    int used = 0;
+    uint64_t total = 0;
+    for (char *line = text; line < text + size;) {
+        char *end = strchr(line, '\n');
+        end = (end == NULL) ? text + size : end + 1;
+        uint64_t bits = strtoull(line, NULL, 10);
+        int i = 0;
+        while (i < used && sizes[i][0] != bits) {
+            i += 1;
+        }
+        if (i == used && used < 64) {
+            sizes[used][0] = bits;
+            sizes[used][1] = 0;
+            used += 1;
+        }
+        if (i < used) {
+            sizes[i][1] += 1;
+        }
+        total += 1;
+        line = end;
+    }
+    free(text);
+
+    fprintf(outfile, "%s: %lu primes\n", path, (unsigned long) total);
+    for (int i = 0; i < used; i += 1) {
+        fprintf(outfile, "   %lu bits: %lu\n", (unsigned long) sizes[i][0], (unsigned long) sizes[i][1]);
+    }
+    return;
+}
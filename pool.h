@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <gmp.h>
+
+bool pool_add(const char *path, uint64_t bits, mpz_t p);
+
+bool pool_take(const char *path, uint64_t bits, mpz_t p);
+
+bool pool_take_pair(const char *path, uint64_t nbits, mpz_t p, mpz_t q);
+
+uint64_t pool_count(const char *path, uint64_t bits);
+
+void pool_status(const char *path, FILE *outfile);
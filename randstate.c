@@ -2,6 +2,8 @@
 #include "numtheory.h"
 #include "rsa.h"
 
+#include <stdio.h>
+
 gmp_randstate_t state;
 
 // The randstate_init() function initiates a global random state using the Mersenne
@@ -24,3 +26,18 @@ void randstate_clear(void) {
     gmp_randclear(state);
     return;
 }
+
+// The random_bytes() function fills a buffer from the operating system's random
+// source. Unlike the seeded state above, this is suitable for secret keys.
+// Inputs: buf = output, len = number of bytes
+// Outputs: true on success, false if the random source couldn't be read
+
+bool random_bytes(uint8_t *buf, size_t len) {
+    FILE *urandom = fopen("/dev/urandom", "rb");
+    if (urandom == NULL) {
+        return false;
+    }
+    size_t j = fread(buf, sizeof(uint8_t), len, urandom);
+    fclose(urandom);
+    return j == len;
+}
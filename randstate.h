@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <gmp.h>
 
@@ -8,3 +10,5 @@ extern gmp_randstate_t state;
 void randstate_init(uint64_t seed);
 
 void randstate_clear(void);
+
+bool random_bytes(uint8_t *buf, size_t len);
@@ -4,7 +4,11 @@
 #include "rsa.h"
 #include "numtheory.h"
 #include "randstate.h"
+#include "hex.h"
+#include "pipeline.h"
+#include "sha256.h"
 
+#include <limits.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -38,26 +42,56 @@ void rsa_make_pub(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t i
         }
     }
 
-    // ptot and qtot are (p-1) and (q-1) parts of totient
-    // tot is totient and rand is random number
+    rsa_make_exp(e, p, q, nbits);
+    return;
+}
+
+// The rsa_make_exp() function picks the public exponent e for two primes: a
+// random number of nbits bits that is coprime with lambda(n)
+// Inputs: e = output carrying variable, the two large primes p and q,
+// and the number of bits
+// Outputs: void
+
+void rsa_make_exp(mpz_t e, mpz_t p, mpz_t q, uint64_t nbits) {
+    // lambda is lambda(n) and rand is random number
     // g is the gcd value
-    mpz_t ptot, qtot, tot, rand, g;
-    mpz_inits(ptot, qtot, rand, tot, g, NULL);
+    mpz_t lambda, rand, g;
+    mpz_inits(lambda, rand, g, NULL);
 
-    mpz_sub_ui(ptot, p, 1);
-    mpz_sub_ui(qtot, q, 1);
-    mpz_mul(tot, ptot, qtot); // totient = (p - 1)(q - 1)
+    // lambda(n) has the same prime factors as the totient, so this is the same
+    // test as before on a smaller number
+    rsa_carmichael(lambda, p, q);
 
     while (true) {
         mpz_urandomb(rand, state, nbits); // make random number
-        gcd(g, rand, tot);
+        gcd(g, rand, lambda);
         if (mpz_cmp_ui(g, 1) == 0) { // if gcd=1, then that random number is our exponent
             mpz_set(e, rand);
             break;
         }
     }
 
-    mpz_clears(rand, ptot, qtot, tot, g, NULL);
+    mpz_clears(lambda, rand, g, NULL);
+    return;
+}
+
+// The rsa_carmichael() function computes the Carmichael function of n = pq,
+// lambda(n) = lcm(p - 1, q - 1), the smallest exponent that takes every number
+// coprime with n back to 1. It divides the totient (p - 1)(q - 1).
+// Inputs: lambda = output, the two large primes p and q
+// Outputs: void
+
+void rsa_carmichael(mpz_t lambda, mpz_t p, mpz_t q) {
+    mpz_t ptot, qtot, g;
+    mpz_inits(ptot, qtot, g, NULL);
+
+    mpz_sub_ui(ptot, p, 1);
+    mpz_sub_ui(qtot, q, 1);
+    gcd(g, ptot, qtot);
+    mpz_mul(lambda, ptot, qtot);
+    mpz_divexact(lambda, lambda, g); // lcm = (p - 1)(q - 1) / gcd(p - 1, q - 1)
+
+    mpz_clears(ptot, qtot, g, NULL);
     return;
 }
 
@@ -67,35 +101,49 @@ void rsa_make_pub(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t i
 // Outputs: void
 
 void rsa_write_pub(mpz_t n, mpz_t e, mpz_t s, char username[], FILE *pbfile) {
-    gmp_fprintf(pbfile, "%Zx\n%Zx\n%Zx\n%s\n", n, e, s, username);
+    HexWriter *w = hex_writer_create(pbfile);
+    hex_write_mpz(w, n);
+    hex_write_mpz(w, e);
+    hex_write_mpz(w, s);
+    hex_write_str(w, username);
+    hex_write_str(w, "\n");
+    hex_writer_delete(&w);
     return;
 }
 
 // The rsa_read_pub() function reads the public key from a file
 // Inputs: n = public modulus, e = public exponent, s = signature,
-// the username, and the file
+// the username (room for LOGIN_NAME_MAX characters), and the file
 // Outputs: void
 
 void rsa_read_pub(mpz_t n, mpz_t e, mpz_t s, char username[], FILE *pbfile) {
-    gmp_fscanf(pbfile, "%Zx\n%Zx\n%Zx\n%s\n", n, e, s, username);
+    HexReader *r = hex_reader_create(pbfile);
+    hex_read_mpz(r, n);
+    hex_read_mpz(r, e);
+    hex_read_mpz(r, s);
+    if (!hex_read_token(r, username, LOGIN_NAME_MAX)) {
+        username[0] = '\0';
+    }
+    hex_reader_delete(&r);
     return;
 }
 
-// The rsa_make_priv() function makes the private key
+// The rsa_make_priv() function makes the private key: the inverse of e modulo
+// lambda(n) rather than the totient. It decrypts the same, and since lambda(n)
+// is the totient divided by gcd(p - 1, q - 1), d is shorter and every
+// decryption and signature takes fewer squarings.
 // Inputs: d = private key, e = public exponent, p = the first large prime
 // and q = the second large prime
 // Outputs: void
 
 void rsa_make_priv(mpz_t d, mpz_t e, mpz_t p, mpz_t q) {
-    mpz_t tot, ptot, qtot;
-    mpz_inits(tot, ptot, qtot, NULL);
+    mpz_t lambda;
+    mpz_init(lambda);
 
-    mpz_sub_ui(ptot, p, 1);
-    mpz_sub_ui(qtot, q, 1);
-    mpz_mul(tot, ptot, qtot); // totient = (p - 1)(q - 1)
-    mod_inverse(d, e, tot); // find the mod inverse
+    rsa_carmichael(lambda, p, q);
+    mod_inverse(d, e, lambda); // find the mod inverse
 
-    mpz_clears(tot, ptot, qtot, NULL);
+    mpz_clear(lambda);
     return;
 }
 
@@ -104,7 +152,10 @@ void rsa_make_priv(mpz_t d, mpz_t e, mpz_t p, mpz_t q) {
 // Outputs: void
 
 void rsa_write_priv(mpz_t n, mpz_t d, FILE *pvfile) {
-    gmp_fprintf(pvfile, "%Zx\n%Zx\n", n, d);
+    HexWriter *w = hex_writer_create(pvfile);
+    hex_write_mpz(w, n);
+    hex_write_mpz(w, d);
+    hex_writer_delete(&w);
     return;
 }
 
@@ -113,7 +164,10 @@ void rsa_write_priv(mpz_t n, mpz_t d, FILE *pvfile) {
 // Outputs: void
 
 void rsa_read_priv(mpz_t n, mpz_t d, FILE *pvfile) {
-    gmp_fscanf(pvfile, "%Zx\n%Zx\n", n, d);
+    HexReader *r = hex_reader_create(pvfile);
+    hex_read_mpz(r, n);
+    hex_read_mpz(r, d);
+    hex_reader_delete(&r);
     return;
 }
 
@@ -128,6 +182,85 @@ void rsa_encrypt(mpz_t c, mpz_t m, mpz_t e, mpz_t n) {
     return;
 }
 
+// The blocks of a file being encrypted or decrypted. The pipeline's reader
+// uses the source or r, its writer uses w or the sink, and for decryption the
+// array; its workers only read n and x.
+typedef struct {
+    ByteSource source;
+    HexReader *r;
+    HexWriter *w;
+    ByteSink sink;
+    void *ctx;
+    uint8_t *array;
+    uint64_t k;
+    mpz_ptr n;
+    mpz_ptr x; // e or d
+} Blocks;
+
+// The encrypt_read() function reads at most k - 1 bytes into the block after
+// its 0xFF byte and converts them
+// Inputs: the blocks, m = output
+// Outputs: false at the end of the input
+
+static bool encrypt_read(void *ctx, mpz_t m) {
+    Blocks *b = (Blocks *) ctx;
+    size_t j = b->source(b->ctx, b->array + 1, b->k - 1);
+    if (j == 0) {
+        return false;
+    }
+    mpz_import(m, j + 1, 1, sizeof(uint8_t), 1, 0, b->array);
+    return true;
+}
+
+// The encrypt_block() function encrypts one block
+// Inputs: the blocks, c = output, m = the block
+// Outputs: void
+
+static void encrypt_block(void *ctx, mpz_t c, mpz_t m) {
+    Blocks *b = (Blocks *) ctx;
+    rsa_encrypt(c, m, b->x, b->n);
+    return;
+}
+
+// The encrypt_write() function writes one encrypted block
+// Inputs: the blocks, c = the block
+// Outputs: void
+
+static void encrypt_write(void *ctx, mpz_t c) {
+    hex_write_mpz(((Blocks *) ctx)->w, c);
+    return;
+}
+
+// The decrypt_read() function reads one encrypted block
+// Inputs: the blocks, c = output
+// Outputs: false at the end of the input
+
+static bool decrypt_read(void *ctx, mpz_t c) {
+    return hex_read_mpz(((Blocks *) ctx)->r, c);
+}
+
+// The decrypt_block() function decrypts one block
+// Inputs: the blocks, m = output, c = the block
+// Outputs: void
+
+static void decrypt_block(void *ctx, mpz_t m, mpz_t c) {
+    Blocks *b = (Blocks *) ctx;
+    rsa_decrypt(m, c, b->x, b->n);
+    return;
+}
+
+// The decrypt_write() function writes one decrypted block without its 0xFF byte
+// Inputs: the blocks, m = the block
+// Outputs: void
+
+static void decrypt_write(void *ctx, mpz_t m) {
+    Blocks *b = (Blocks *) ctx;
+    size_t j;
+    mpz_export(b->array, &j, 1, sizeof(uint8_t), 1, 0, m); // convert the read bytes.
+    b->sink(b->ctx, (b->array + 1), j - 1);
+    return;
+}
+
 // The rsa_encrypt_file() function encrypts a given infile and places the
 // encrypted message into the outfile
 // Inputs: the input and output files, n = public modulus, e = public
@@ -135,6 +268,17 @@ void rsa_encrypt(mpz_t c, mpz_t m, mpz_t e, mpz_t n) {
 // Outputs: void
 
 void rsa_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e) {
+    rsa_encrypt_source(rsa_file_source, infile, outfile, n, e);
+    return;
+}
+
+// The rsa_encrypt_source() function is rsa_encrypt_file() for plaintext that
+// comes from somewhere other than a plain file, such as a compressor
+// Inputs: the source and its context, the output file, n = public modulus,
+// e = public exponent
+// Outputs: void
+
+void rsa_encrypt_source(ByteSource source, void *ctx, FILE *outfile, mpz_t n, mpz_t e) {
     // calculate the block size
     uint64_t k = floor((mpz_sizeinbase(n, 2) - 1) / 8);
 
@@ -144,21 +288,15 @@ void rsa_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e) {
     // set 0th byte of block to 0xFF
     array[0] = 0xFF;
 
-    // loop variables
-    uint64_t j;
-    mpz_t m, c;
-    mpz_inits(m, c, NULL);
-
-    // read the infile and encrypt
-    while ((j = fread(array + 1, sizeof(uint8_t), k - 1, infile)) > 0) {
-        // read at most k - 1 bytes from infile into the block starting at index 1
-        mpz_import(m, j + 1, 1, sizeof(uint8_t), 1, 0, array); // convert the read bytes,
-        rsa_encrypt(c, m, e, n);
-        gmp_fprintf(outfile, "%Zx\n", c);
-    }
+    // read, encrypt and write the blocks in a pipeline, picking the hex kernel
+    // before the threads use it
+    hex_kernel();
+    HexWriter *w = hex_writer_create(outfile);
+    Blocks b = { .source = source, .ctx = ctx, .array = array, .k = k, .w = w, .n = n, .x = e };
+    pipeline_run(encrypt_read, encrypt_block, encrypt_write, &b);
 
+    hex_writer_delete(&w);
     free(array);
-    mpz_clears(m, c, NULL);
     return;
 }
 
@@ -179,26 +317,48 @@ void rsa_decrypt(mpz_t m, mpz_t c, mpz_t d, mpz_t n) {
 // Outputs: void
 
 void rsa_decrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t d) {
+    HexReader *r = hex_reader_create(infile);
+    rsa_decrypt_hex(r, rsa_file_sink, outfile, n, d);
+    hex_reader_delete(&r);
+    return;
+}
+
+// The rsa_decrypt_hex() function is rsa_decrypt_file() for input that is already
+// being read, so a caller can look at the start of the file first
+// Inputs: the reader, where the plaintext goes and its context,
+// n = public modulus, d = private key
+// Outputs: void
+
+void rsa_decrypt_hex(HexReader *r, ByteSink sink, void *ctx, mpz_t n, mpz_t d) {
     // calculate the block size
     uint64_t k = floor((mpz_sizeinbase(n, 2) - 1) / 8);
 
     // dynamically allocate an array that can hold k bytes
     uint8_t *array = (uint8_t *) calloc(k, sizeof(uint8_t));
 
-    // loop variables
-    uint64_t j;
-    mpz_t c, m;
-    mpz_inits(c, m, NULL);
-
-    while (!feof(infile)) {
-        j = gmp_fscanf(infile, "%Zx\n", c);
-        rsa_decrypt(m, c, d, n);
-        mpz_export(array, &j, 1, sizeof(uint8_t), 1, 0, m); // convert the read bytes.
-        fwrite((array + 1), sizeof(uint8_t), j - 1, outfile);
-    }
+    // read, decrypt and write the blocks in a pipeline
+    hex_kernel();
+    Blocks b = { .r = r, .sink = sink, .ctx = ctx, .array = array, .k = k, .n = n, .x = d };
+    pipeline_run(decrypt_read, decrypt_block, decrypt_write, &b);
 
     free(array);
-    mpz_clears(c, m, NULL);
+    return;
+}
+
+// The rsa_file_source() function is the ByteSource for a plain file
+// Inputs: the file, buf = output, len = the most bytes to read
+// Outputs: the number of bytes read
+
+size_t rsa_file_source(void *infile, uint8_t *buf, size_t len) {
+    return fread(buf, sizeof(uint8_t), len, (FILE *) infile);
+}
+
+// The rsa_file_sink() function is the ByteSink for a plain file
+// Inputs: the file, the data and its length
+// Outputs: void
+
+void rsa_file_sink(void *outfile, const uint8_t *buf, size_t len) {
+    fwrite(buf, sizeof(uint8_t), len, (FILE *) outfile);
     return;
 }
 
@@ -229,3 +389,77 @@ bool rsa_verify(mpz_t m, mpz_t s, mpz_t e, mpz_t n) {
         return false;
     }
 }
+
+// The DER DigestInfo prefix for SHA-256 from PKCS #1, which goes in front of the
+// digest so the signature also says which hash made it
+static const uint8_t sha256_info[] = { 0x30, 0x31, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01,
+    0x65, 0x03, 0x04, 0x02, 0x01, 0x05, 0x00, 0x04, 0x20 };
+
+// The encode_digest() function pads a digest the PKCS #1 v1.5 way:
+// 00 01 FF ... FF 00 DigestInfo digest, as long as n in bytes
+// Inputs: m = output, the digest, n = public modulus
+// Outputs: true, or false if n is too small to hold the padded digest
+
+static bool encode_digest(mpz_t m, const uint8_t digest[], mpz_t n) {
+    size_t k = (mpz_sizeinbase(n, 2) + 7) / 8;
+    size_t t = sizeof(sha256_info) + SHA256_DIGEST;
+    if (k < t + 11) {
+        return false;
+    }
+    uint8_t *em = (uint8_t *) malloc(k);
+    em[0] = 0x00;
+    em[1] = 0x01;
+    memset(em + 2, 0xFF, k - t - 3);
+    em[k - t - 1] = 0x00;
+    memcpy(em + k - t, sha256_info, sizeof(sha256_info));
+    memcpy(em + k - SHA256_DIGEST, digest, SHA256_DIGEST);
+    mpz_import(m, k, 1, sizeof(uint8_t), 1, 0, em);
+    free(em);
+    return true;
+}
+
+// The rsa_sign_digest() function signs a SHA-256 digest, so any amount of data
+// costs one exponentiation
+// Inputs: s = signature, the digest, d = private key, n = public modulus
+// Outputs: true, or false if the key is too small (under RSA_DIGEST_BITS)
+
+bool rsa_sign_digest(mpz_t s, const uint8_t digest[], mpz_t d, mpz_t n) {
+    mpz_t m;
+    mpz_init(m);
+    bool ok = encode_digest(m, digest, n);
+    if (ok) {
+        rsa_sign(s, m, d, n);
+    }
+    mpz_clear(m);
+    return ok;
+}
+
+// The rsa_verify_digest() function checks a signature made by rsa_sign_digest()
+// Inputs: the digest, s = signature, e = public exponent, n = public modulus
+// Outputs: true if the signature is valid for the digest
+
+bool rsa_verify_digest(const uint8_t digest[], mpz_t s, mpz_t e, mpz_t n) {
+    mpz_t m;
+    mpz_init(m);
+    bool ok = mpz_sgn(s) > 0 && mpz_cmp(s, n) < 0 && encode_digest(m, digest, n) && rsa_verify(m, s, e, n);
+    mpz_clear(m);
+    return ok;
+}
+
+// The rsa_fingerprint() function identifies a key by the SHA-256 of its modulus
+// Inputs: fp = output (SHA256_DIGEST bytes), n = public modulus
+// Outputs: void
+
+void rsa_fingerprint(uint8_t fp[], mpz_t n) {
+    size_t count = (mpz_sizeinbase(n, 2) + 7) / 8;
+    uint8_t *bytes = (uint8_t *) calloc(count, sizeof(uint8_t));
+    mpz_export(bytes, &count, 1, sizeof(uint8_t), 1, 0, n);
+
+    SHA256 ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, bytes, count);
+    sha256_final(&ctx, fp);
+
+    free(bytes);
+    return;
+}
@@ -5,12 +5,26 @@
 #include <stdio.h>
 #include <gmp.h>
 
+#include "hex.h"
+
+// Where rsa_encrypt_source() gets plaintext from and rsa_decrypt_hex() puts it.
+// A source fills buf completely unless the input ends.
+typedef size_t (*ByteSource)(void *ctx, uint8_t *buf, size_t len);
+typedef void (*ByteSink)(void *ctx, const uint8_t *buf, size_t len);
+
+// The smallest modulus rsa_sign_digest() can pad a SHA-256 digest for
+#define RSA_DIGEST_BITS ((19 + 32 + 11) * 8 - 7)
+
 void rsa_make_pub(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t iters);
 
+void rsa_make_exp(mpz_t e, mpz_t p, mpz_t q, uint64_t nbits);
+
 void rsa_write_pub(mpz_t n, mpz_t e, mpz_t s, char username[], FILE *pbfile);
 
 void rsa_read_pub(mpz_t n, mpz_t e, mpz_t s, char username[], FILE *pbfile);
 
+void rsa_carmichael(mpz_t lambda, mpz_t p, mpz_t q);
+
 void rsa_make_priv(mpz_t d, mpz_t e, mpz_t p, mpz_t q);
 
 void rsa_write_priv(mpz_t n, mpz_t d, FILE *pvfile);
@@ -21,10 +35,24 @@ void rsa_encrypt(mpz_t c, mpz_t m, mpz_t e, mpz_t n);
 
 void rsa_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e);
 
+void rsa_encrypt_source(ByteSource source, void *ctx, FILE *outfile, mpz_t n, mpz_t e);
+
 void rsa_decrypt(mpz_t m, mpz_t c, mpz_t d, mpz_t n);
 
 void rsa_decrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t d);
 
+void rsa_decrypt_hex(HexReader *r, ByteSink sink, void *ctx, mpz_t n, mpz_t d);
+
+size_t rsa_file_source(void *infile, uint8_t *buf, size_t len);
+
+void rsa_file_sink(void *outfile, const uint8_t *buf, size_t len);
+
 void rsa_sign(mpz_t s, mpz_t m, mpz_t d, mpz_t n);
 
 bool rsa_verify(mpz_t m, mpz_t s, mpz_t e, mpz_t n);
+
+bool rsa_sign_digest(mpz_t s, const uint8_t digest[], mpz_t d, mpz_t n);
+
+bool rsa_verify_digest(const uint8_t digest[], mpz_t s, mpz_t e, mpz_t n);
+
+void rsa_fingerprint(uint8_t fp[], mpz_t n);
@@ -0,0 +1,335 @@
+// SHA-256 as specified in FIPS 180-4
+#include "sha256.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SHA_X86 1
+#include <immintrin.h>
+#endif
+
+#define SHA_READ   (1024 * 1024) // bytes per read when a file can't be mapped
+#define SHA_WINDOW (256 * 1024 * 1024) // bytes mapped at a time
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+// The compress_block() function mixes one 64 byte block into the hash state
+// Inputs: h = the hash state, block = the data
+// Outputs: void
+
+static void compress_block(uint32_t h[8], const uint8_t *block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i += 1) {
+        w[i] = ((uint32_t) block[4 * i] << 24) | ((uint32_t) block[4 * i + 1] << 16)
+               | ((uint32_t) block[4 * i + 2] << 8) | (uint32_t) block[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i += 1) {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+    uint32_t e = h[4], f = h[5], g = h[6], hh = h[7];
+    for (int i = 0; i < 64; i += 1) {
+        uint32_t t1 = hh + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+        uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        hh = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+    h[5] += f;
+    h[6] += g;
+    h[7] += hh;
+    return;
+}
+
+// The compress_scalar() function mixes whole blocks into the hash state
+// Inputs: h = the hash state, the data, the number of 64 byte blocks
+// Outputs: void
+
+static void compress_scalar(uint32_t h[8], const uint8_t *data, size_t blocks) {
+    for (size_t i = 0; i < blocks; i += 1) {
+        compress_block(h, data + 64 * i);
+    }
+    return;
+}
+
+#ifdef SHA_X86
+// The compress_shani() function is compress_scalar() using the SHA extensions,
+// which do two rounds per instruction and the message schedule four words at a time
+// Inputs: h = the hash state, the data, the number of 64 byte blocks
+// Outputs: void
+
+__attribute__((target("sha,sse4.1,ssse3"))) static void compress_shani(
+    uint32_t h[8], const uint8_t *data, size_t blocks) {
+    const __m128i swap = _mm_set_epi64x(0x0c0d0e0f08090a0bLL, 0x0405060700010203LL);
+
+    // the instructions want the state as ABEF and CDGH
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &h[0]), 0xB1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &h[4]), 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    for (size_t b = 0; b < blocks; b += 1) {
+        const uint8_t *block = data + 64 * b;
+        __m128i abef = state0, cdgh = state1;
+        __m128i w[4];
+        for (int i = 0; i < 16; i += 1) {
+            if (i < 4) {
+                w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (block + 16 * i)), swap);
+            } else {
+                // w[i] = sigma schedule of the previous 16 words
+                __m128i x = _mm_sha256msg1_epu32(w[i % 4], w[(i + 1) % 4]);
+                x = _mm_add_epi32(x, _mm_alignr_epi8(w[(i + 3) % 4], w[(i + 2) % 4], 4));
+                w[i % 4] = _mm_sha256msg2_epu32(x, w[(i + 3) % 4]);
+            }
+            __m128i msg = _mm_add_epi32(w[i % 4], _mm_loadu_si128((const __m128i *) &K[4 * i]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+        }
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    _mm_storeu_si128((__m128i *) &h[0], _mm_blend_epi16(tmp, state1, 0xF0));
+    _mm_storeu_si128((__m128i *) &h[4], _mm_alignr_epi8(state1, tmp, 8));
+    return;
+}
+#endif
+
+// The kernel in use, picked once from what the CPU supports
+static void (*compress)(uint32_t h[8], const uint8_t *, size_t) = NULL;
+static const char *kernel_name = "scalar";
+
+// The pick_kernel() function chooses the SHA extensions if the CPU has them
+// Inputs: void
+// Outputs: void
+
+static void pick_kernel(void) {
+#ifdef SHA_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1")) {
+        kernel_name = "shani";
+        compress = compress_shani;
+        return;
+    }
+#endif
+    compress = compress_scalar;
+    return;
+}
+
+// The sha256_kernel() function names the compression function in use. Calling
+// it once before starting threads that hash makes the choice up front.
+// Inputs: void
+// Outputs: "scalar" or "shani"
+
+const char *sha256_kernel(void) {
+    if (compress == NULL) {
+        pick_kernel();
+    }
+    return kernel_name;
+}
+
+// The sha256_init() function starts a new hash
+// Inputs: the context
+// Outputs: void
+
+void sha256_init(SHA256 *ctx) {
+    static const uint32_t iv[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f,
+        0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    if (compress == NULL) {
+        pick_kernel();
+    }
+    memcpy(ctx->h, iv, sizeof(iv));
+    ctx->total = 0;
+    ctx->fill = 0;
+    return;
+}
+
+// The sha256_update() function hashes more data. Whole blocks are compressed
+// straight from the caller's buffer without copying.
+// Inputs: the context, the data and its length in bytes
+// Outputs: void
+
+void sha256_update(SHA256 *ctx, const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t *) data;
+    ctx->total += len;
+
+    if (ctx->fill > 0) {
+        size_t take = 64 - ctx->fill < len ? 64 - ctx->fill : len;
+        memcpy(ctx->block + ctx->fill, p, take);
+        ctx->fill += take;
+        p += take;
+        len -= take;
+        if (ctx->fill < 64) {
+            return;
+        }
+        compress(ctx->h, ctx->block, 1);
+        ctx->fill = 0;
+    }
+    if (len >= 64) {
+        compress(ctx->h, p, len / 64);
+        p += len - len % 64;
+        len %= 64;
+    }
+    memcpy(ctx->block, p, len);
+    ctx->fill = len;
+    return;
+}
+
+// The sha256_final() function pads the message and produces the digest
+// Inputs: the context and where to put the digest
+// Outputs: void
+
+void sha256_final(SHA256 *ctx, uint8_t digest[SHA256_DIGEST]) {
+    uint64_t bits = ctx->total * 8;
+    uint8_t pad[72] = { 0x80 };
+    size_t padlen = (ctx->fill < 56) ? 56 - ctx->fill : 120 - ctx->fill;
+    for (int i = 0; i < 8; i += 1) {
+        pad[padlen + i] = (uint8_t) (bits >> (56 - 8 * i));
+    }
+    sha256_update(ctx, pad, padlen + 8);
+
+    for (int i = 0; i < 8; i += 1) {
+        digest[4 * i] = (uint8_t) (ctx->h[i] >> 24);
+        digest[4 * i + 1] = (uint8_t) (ctx->h[i] >> 16);
+        digest[4 * i + 2] = (uint8_t) (ctx->h[i] >> 8);
+        digest[4 * i + 3] = (uint8_t) ctx->h[i];
+    }
+    return;
+}
+
+// The hmac_sha256_init() function starts an HMAC-SHA256 (RFC 2104) under a key
+// Inputs: the context, the key and its length in bytes
+// Outputs: void
+
+void hmac_sha256_init(HMACSHA256 *ctx, const uint8_t *key, size_t len) {
+    uint8_t block[64] = { 0 };
+    if (len > sizeof(block)) {
+        // longer keys are hashed first
+        SHA256 k;
+        sha256_init(&k);
+        sha256_update(&k, key, len);
+        sha256_final(&k, block);
+    } else {
+        memcpy(block, key, len);
+    }
+    uint8_t pad[64];
+    for (int i = 0; i < 64; i += 1) {
+        pad[i] = block[i] ^ 0x36;
+    }
+    sha256_init(&ctx->inner);
+    sha256_update(&ctx->inner, pad, sizeof(pad));
+    for (int i = 0; i < 64; i += 1) {
+        pad[i] = block[i] ^ 0x5c;
+    }
+    sha256_init(&ctx->outer);
+    sha256_update(&ctx->outer, pad, sizeof(pad));
+    memset(block, 0, sizeof(block));
+    memset(pad, 0, sizeof(pad));
+    return;
+}
+
+// The hmac_sha256_update() function adds data to an HMAC-SHA256
+// Inputs: the context, the data and its length in bytes
+// Outputs: void
+
+void hmac_sha256_update(HMACSHA256 *ctx, const void *data, size_t len) {
+    sha256_update(&ctx->inner, data, len);
+    return;
+}
+
+// The hmac_sha256_final() function finishes an HMAC-SHA256
+// Inputs: the context and where to put the MAC
+// Outputs: void
+
+void hmac_sha256_final(HMACSHA256 *ctx, uint8_t mac[SHA256_DIGEST]) {
+    uint8_t inner[SHA256_DIGEST];
+    sha256_final(&ctx->inner, inner);
+    sha256_update(&ctx->outer, inner, SHA256_DIGEST);
+    sha256_final(&ctx->outer, mac);
+    memset(ctx, 0, sizeof(*ctx));
+    return;
+}
+
+// The sha256_file() function hashes everything left in a file. Regular files
+// are mapped a window at a time so the data is hashed straight from the page
+// cache; pipes and the like are read in large blocks.
+// Inputs: the file and where to put the digest
+// Outputs: true if the file was read to the end without errors
+
+bool sha256_file(FILE *infile, uint8_t digest[SHA256_DIGEST]) {
+    SHA256 ctx;
+    sha256_init(&ctx);
+
+    int fd = fileno(infile);
+    struct stat st;
+    off_t pos = ftello(infile);
+    long page = sysconf(_SC_PAGESIZE);
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && pos >= 0 && page > 0) {
+        // mappings start on a page boundary, but hashing starts where the file is
+        off_t start = pos - pos % page;
+        off_t off = start;
+        while (off < st.st_size) {
+            size_t len = (st.st_size - off < SHA_WINDOW) ? (size_t) (st.st_size - off) : SHA_WINDOW;
+            uint8_t *map = (uint8_t *) mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, off);
+            if (map == MAP_FAILED) {
+                break;
+            }
+            madvise(map, len, MADV_SEQUENTIAL);
+            size_t skip = (off < pos) ? (size_t) (pos - off) : 0;
+            sha256_update(&ctx, map + skip, len - skip);
+            munmap(map, len);
+            off += (off_t) len;
+        }
+        if (off >= st.st_size) {
+            fseeko(infile, 0, SEEK_END);
+            sha256_final(&ctx, digest);
+            return true;
+        }
+        if (off > start) {
+            return false; // failed part way through
+        }
+        // the file couldn't be mapped at all, so read it instead
+    }
+
+    uint8_t *buf = (uint8_t *) malloc(SHA_READ);
+    size_t j;
+    while ((j = fread(buf, sizeof(uint8_t), SHA_READ, infile)) > 0) {
+        sha256_update(&ctx, buf, j);
+    }
+    free(buf);
+    sha256_final(&ctx, digest);
+    return !ferror(infile);
+}
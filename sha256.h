@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define SHA256_DIGEST 32 // bytes in a digest
+
+typedef struct {
+    uint32_t h[8];
+    uint64_t total; // bytes hashed so far
+    uint8_t block[64];
+    size_t fill; // bytes waiting in block
+} SHA256;
+
+// HMAC-SHA256: the inner hash of the key xor ipad and the message, and the
+// outer hash of the key xor opad, finished with the inner digest
+typedef struct {
+    SHA256 inner;
+    SHA256 outer;
+} HMACSHA256;
+
+void sha256_init(SHA256 *ctx);
+
+void sha256_update(SHA256 *ctx, const void *data, size_t len);
+
+void sha256_final(SHA256 *ctx, uint8_t digest[SHA256_DIGEST]);
+
+bool sha256_file(FILE *infile, uint8_t digest[SHA256_DIGEST]);
+
+void hmac_sha256_init(HMACSHA256 *ctx, const uint8_t *key, size_t len);
+
+void hmac_sha256_update(HMACSHA256 *ctx, const void *data, size_t len);
+
+void hmac_sha256_final(HMACSHA256 *ctx, uint8_t mac[SHA256_DIGEST]);
+
+const char *sha256_kernel(void);
@@ -0,0 +1,107 @@
+#include "rsa.h"
+#include "set.h"
+#include "hex.h"
+#include "sha256.h"
+
+#include <stdio.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+// This function prints out information about how to properly use the file
+// Inputs: void
+// Outputs: void
+
+void message(void) {
+    fprintf(stderr, "SYNOPSIS\n"
+                    "   Signs a file with an RSA private key.\n"
+                    "   The signature is checked by the verify program.\n"
+                    "\n"
+                    "USAGE\n"
+                    "   ./sign [-hv] [-i infile] [-o sigfile] [-n privkey]\n"
+                    "\n"
+                    "OPTIONS\n"
+                    "   -h              Display program help and usage.\n"
+                    "   -v              Display verbose program output.\n"
+                    "   -i infile       Input file of data to sign (default: stdin).\n"
+                    "   -o sigfile      Output file for the signature (default: stdout).\n"
+                    "   -n pvfile       Private key file (default: rsa.priv).\n");
+    return;
+}
+
+typedef enum { VERBOSE } Sign;
+#define OPTIONS "hvn:i:o:"
+
+int main(int argc, char **argv) {
+    Set chosen = empty_set();
+    int option = 0;
+    FILE *infile = stdin;
+    FILE *outfile = stdout;
+    char *pvpath = "rsa.priv";
+
+    while ((option = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (option) {
+        case 'h': message(); return 0;
+        case 'v':
+            // verbose printing was chosen
+            chosen = insert_set(VERBOSE, chosen);
+            break;
+        case 'n':
+            // private file path specified
+            pvpath = optarg;
+            break;
+        case 'i':
+            infile = fopen(optarg, "rb");
+            if (infile == NULL) {
+                fprintf(stderr, "%s: No such file or directory\n", optarg);
+                return 1;
+            }
+            break;
+        case 'o':
+            outfile = fopen(optarg, "w");
+            if (outfile == NULL) {
+                fprintf(stderr, "%s: No such file or directory\n", optarg);
+                return 1;
+            }
+            break;
+        default: message(); return 1;
+        }
+    }
+
+    FILE *pvfile = fopen(pvpath, "r");
+    if (pvfile == NULL) {
+        fprintf(stderr, "%s: No such file or directory\n", pvpath);
+        return 1;
+    }
+    mpz_t n, d, s;
+    mpz_inits(n, d, s, NULL);
+    rsa_read_priv(n, d, pvfile);
+    fclose(pvfile);
+
+    // hash the whole input, then sign just the digest
+    int status = 0;
+    uint8_t digest[SHA256_DIGEST];
+    if (!sha256_file(infile, digest)) {
+        fprintf(stderr, "Error: couldn't read the input.\n");
+        status = 1;
+    } else if (!rsa_sign_digest(s, digest, d, n)) {
+        fprintf(stderr, "Error: the key is too small to sign with, it needs at least %d bits.\n",
+            RSA_DIGEST_BITS);
+        status = 1;
+    } else {
+        if (member_set(VERBOSE, chosen)) {
+            char hex[2 * SHA256_DIGEST + 1];
+            hex[hex_encode(hex, digest, SHA256_DIGEST)] = '\0';
+            fprintf(stderr, "sha256 (%s) = %s\n", sha256_kernel(), hex);
+            gmp_fprintf(stderr, "s (%d bits) = %Zd\n", mpz_sizeinbase(s, 2), s);
+        }
+        HexWriter *w = hex_writer_create(outfile);
+        hex_write_mpz(w, s);
+        hex_writer_delete(&w);
+    }
+
+    mpz_clears(n, d, s, NULL);
+    fclose(infile);
+    fclose(outfile);
+    return status;
+}
@@ -0,0 +1,392 @@
+// Asynchronous file I/O through Linux io_uring, for input and output on slow
+// storage. A stream owns URING_DEPTH buffers of URING_BLOCK bytes, registered
+// with the kernel once. Reading keeps every buffer that isn't being consumed
+// in flight on the following blocks of the file, and writing hands each full
+// buffer to the kernel and carries on filling the next, so the disk works
+// while the blocks are being encrypted or decrypted. The stream is wrapped in
+// a FILE with fopencookie(), so everything that reads or writes a FILE works
+// unchanged. The system calls are made directly, so liburing isn't needed.
+//
+// Only regular files are read and written this way, since every request
+// carries its own offset. Anything else, or a kernel without io_uring, keeps
+// the plain stdio file.
+#define _GNU_SOURCE
+#include "uring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#define URING_DEPTH 8
+#define URING_BLOCK (1 << 20)
+
+// One buffer and the part of the file it holds
+typedef struct {
+    off_t offset; // where the buffer starts in the file
+    size_t len; // bytes read into it, or waiting to be written
+    size_t pos; // bytes consumed, or written so far
+    bool busy; // a request for it is in flight
+} Slot;
+
+typedef struct {
+    int ring;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_map, *cq_map;
+    size_t sq_size, cq_size, sqes_size;
+    FILE *file; // the stdio file underneath, closed with the stream
+    int fd;
+    bool writing;
+    bool fixed; // the buffers are registered
+    bool failed;
+    uint8_t *buf;
+    Slot slots[URING_DEPTH];
+    size_t cur; // the slot being consumed or filled
+    off_t next; // file offset of the next block to read or write
+} Uring;
+
+// The ring_setup() function creates the ring and maps its queues
+// Inputs: the stream
+// Outputs: true if the kernel supports io_uring
+
+static bool ring_setup(Uring *u) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    u->ring = (int) syscall(__NR_io_uring_setup, URING_DEPTH, &p);
+    if (u->ring < 0) {
+        return false;
+    }
+    u->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) {
+        u->sq_size = u->cq_size = (u->sq_size > u->cq_size) ? u->sq_size : u->cq_size;
+    }
+    u->sq_map = mmap(NULL, u->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->ring,
+        IORING_OFF_SQ_RING);
+    u->cq_map = single ? u->sq_map
+                       : mmap(NULL, u->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           u->ring, IORING_OFF_CQ_RING);
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = (struct io_uring_sqe *) mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, u->ring, IORING_OFF_SQES);
+    if (u->sq_map == MAP_FAILED || u->cq_map == MAP_FAILED || u->sqes == MAP_FAILED) {
+        return false;
+    }
+    uint8_t *sq = (uint8_t *) u->sq_map;
+    uint8_t *cq = (uint8_t *) u->cq_map;
+    u->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    u->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *) (sq + p.sq_off.array);
+    u->cq_head = (unsigned *) (cq + p.cq_off.head);
+    u->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    u->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+    // registered buffers save mapping the pages on every request, but plain
+    // requests work too if registering isn't allowed
+    struct iovec iov[URING_DEPTH];
+    for (size_t i = 0; i < URING_DEPTH; i += 1) {
+        iov[i].iov_base = u->buf + i * URING_BLOCK;
+        iov[i].iov_len = URING_BLOCK;
+    }
+    u->fixed = syscall(__NR_io_uring_register, u->ring, IORING_REGISTER_BUFFERS, iov, URING_DEPTH) == 0;
+    return true;
+}
+
+// The ring_teardown() function unmaps the queues and closes the ring
+// Inputs: the stream
+// Outputs: void
+
+static void ring_teardown(Uring *u) {
+    if (u->sqes != NULL && u->sqes != MAP_FAILED) {
+        munmap(u->sqes, u->sqes_size);
+    }
+    if (u->cq_map != NULL && u->cq_map != MAP_FAILED && u->cq_map != u->sq_map) {
+        munmap(u->cq_map, u->cq_size);
+    }
+    if (u->sq_map != NULL && u->sq_map != MAP_FAILED) {
+        munmap(u->sq_map, u->sq_size);
+    }
+    if (u->ring >= 0) {
+        close(u->ring);
+    }
+    return;
+}
+
+// The submit() function sends the request for the rest of a slot: the unread
+// part of a read, or the unwritten part of a write
+// Inputs: the stream and the slot
+// Outputs: void
+
+static void submit(Uring *u, size_t i) {
+    Slot *s = &u->slots[i];
+    unsigned tail = *u->sq_tail;
+    unsigned index = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    uint8_t *base = u->buf + i * URING_BLOCK;
+    if (u->writing) {
+        sqe->opcode = u->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->addr = (uint64_t) (uintptr_t) (base + s->pos);
+        sqe->len = (uint32_t) (s->len - s->pos);
+        sqe->off = (uint64_t) (s->offset + (off_t) s->pos);
+    } else {
+        sqe->opcode = u->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->addr = (uint64_t) (uintptr_t) (base + s->len);
+        sqe->len = (uint32_t) (URING_BLOCK - s->len);
+        sqe->off = (uint64_t) (s->offset + (off_t) s->len);
+    }
+    sqe->fd = u->fd;
+    sqe->buf_index = (uint16_t) i;
+    sqe->user_data = i;
+    u->sq_array[index] = index;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    s->busy = true;
+    while (syscall(__NR_io_uring_enter, u->ring, 1, 0, 0, NULL, 0) < 0) {
+        if (errno != EINTR) {
+            u->failed = true;
+            s->busy = false;
+            return;
+        }
+    }
+    return;
+}
+
+// The complete() function handles the result of one request: short reads and
+// writes go back for the rest, and a read of nothing is the end of the file
+// Inputs: the stream, the slot and the result
+// Outputs: void
+
+static void complete(Uring *u, size_t i, int res) {
+    Slot *s = &u->slots[i];
+    s->busy = false;
+    if (res == -EINTR || res == -EAGAIN) {
+        submit(u, i);
+    } else if (res < 0) {
+        u->failed = true;
+    } else if (u->writing) {
+        s->pos += (size_t) res;
+        if (s->pos < s->len) {
+            submit(u, i);
+        } else {
+            s->len = s->pos = 0;
+        }
+    } else if (res > 0) {
+        s->len += (size_t) res;
+        if (s->len < URING_BLOCK) {
+            submit(u, i);
+        }
+    }
+    return;
+}
+
+// The reap() function waits for at least one request to finish and handles
+// every finished one
+// Inputs: the stream
+// Outputs: false if the ring itself failed
+
+static bool reap(Uring *u) {
+    while (syscall(__NR_io_uring_enter, u->ring, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+        if (errno != EINTR) {
+            u->failed = true;
+            return false;
+        }
+    }
+    unsigned head = *u->cq_head;
+    while (head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+        size_t i = (size_t) cqe->user_data;
+        int res = cqe->res;
+        head += 1;
+        __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+        complete(u, i, res);
+    }
+    return true;
+}
+
+// The start_read() function points a slot at the next block and reads it
+// Inputs: the stream and the slot
+// Outputs: void
+
+static void start_read(Uring *u, size_t i) {
+    Slot *s = &u->slots[i];
+    s->offset = u->next;
+    s->len = s->pos = 0;
+    u->next += URING_BLOCK;
+    submit(u, i);
+    return;
+}
+
+// The start_write() function writes out a slot's pending bytes at the next offset
+// Inputs: the stream and the slot
+// Outputs: void
+
+static void start_write(Uring *u, size_t i) {
+    Slot *s = &u->slots[i];
+    s->offset = u->next;
+    s->pos = 0;
+    u->next += (off_t) s->len;
+    submit(u, i);
+    return;
+}
+
+// The uring_read() function is the cookie read function: it copies out of the
+// current slot, waiting for it if needed, and sends each emptied slot after
+// the furthest block asked for
+// Inputs: the stream, buf = output, size = the most bytes to read
+// Outputs: the number of bytes read, 0 at end of file, or -1 on error
+
+static ssize_t uring_read(void *cookie, char *buf, size_t size) {
+    Uring *u = (Uring *) cookie;
+    size_t total = 0;
+    while (total < size) {
+        Slot *s = &u->slots[u->cur];
+        while (s->busy && !u->failed && reap(u)) {
+        }
+        if (u->failed) {
+            return (total > 0) ? (ssize_t) total : -1;
+        }
+        if (s->pos == s->len) {
+            if (s->len < URING_BLOCK) {
+                break; // a short block is the end of the file
+            }
+            start_read(u, u->cur);
+            u->cur = (u->cur + 1) % URING_DEPTH;
+            continue;
+        }
+        size_t take = (s->len - s->pos < size - total) ? s->len - s->pos : size - total;
+        memcpy(buf + total, u->buf + u->cur * URING_BLOCK + s->pos, take);
+        s->pos += take;
+        total += take;
+    }
+    return (ssize_t) total;
+}
+
+// The uring_write() function is the cookie write function: it copies into the
+// current slot and sends it once full, waiting only when every slot is in flight
+// Inputs: the stream, the data and its length
+// Outputs: the number of bytes taken, or -1 on error
+
+static ssize_t uring_write(void *cookie, const char *buf, size_t size) {
+    Uring *u = (Uring *) cookie;
+    size_t total = 0;
+    while (total < size) {
+        Slot *s = &u->slots[u->cur];
+        while (s->busy && !u->failed && reap(u)) {
+        }
+        if (u->failed) {
+            return -1;
+        }
+        size_t take = (URING_BLOCK - s->len < size - total) ? URING_BLOCK - s->len : size - total;
+        memcpy(u->buf + u->cur * URING_BLOCK + s->len, buf + total, take);
+        s->len += take;
+        total += take;
+        if (s->len == URING_BLOCK) {
+            start_write(u, u->cur);
+            u->cur = (u->cur + 1) % URING_DEPTH;
+        }
+    }
+    return (ssize_t) total;
+}
+
+// The uring_free() function waits for every request, even after a failure,
+// since the kernel may still be using the buffers, then frees the stream and
+// closes the file underneath
+// Inputs: the stream
+// Outputs: 0, or EOF if anything failed
+
+static int uring_free(Uring *u) {
+    for (size_t i = 0; i < URING_DEPTH; i += 1) {
+        while (u->slots[i].busy && reap(u)) {
+        }
+    }
+    // leave the descriptor where stdio would have, in case it is shared
+    if (u->writing && !u->failed) {
+        lseek(u->fd, u->next, SEEK_SET);
+    }
+    bool failed = u->failed;
+    ring_teardown(u);
+    free(u->buf);
+    FILE *file = u->file;
+    free(u);
+    return (fclose(file) != 0 || failed) ? EOF : 0;
+}
+
+// The uring_close() function is the cookie close function: it writes out the
+// last partial slot first
+// Inputs: the stream
+// Outputs: 0, or EOF if anything failed
+
+static int uring_close(void *cookie) {
+    Uring *u = (Uring *) cookie;
+    if (u->writing && u->slots[u->cur].len > 0 && !u->failed) {
+        start_write(u, u->cur);
+    }
+    return uring_free(u);
+}
+
+// The uring_open() function puts an open file behind io_uring. Nothing may have
+// been read from the file yet, and nothing else may write to it afterwards.
+// Inputs: the file and "r" or "w"
+// Outputs: a new FILE that owns file and closes it, or file itself when it isn't
+// a regular file or io_uring can't be used
+
+FILE *uring_open(FILE *file, const char *mode) {
+    int fd = fileno(file);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return file;
+    }
+    // appending ignores the offsets, so the blocks could land out of order
+    fflush(file);
+    off_t start = lseek(fd, 0, SEEK_CUR);
+    if (start < 0 || (fcntl(fd, F_GETFL) & O_APPEND)) {
+        return file;
+    }
+
+    Uring *u = (Uring *) calloc(1, sizeof(Uring));
+    u->ring = -1;
+    u->file = file;
+    u->fd = fd;
+    u->writing = mode[0] == 'w';
+    u->next = start;
+    if (posix_memalign((void **) &u->buf, 4096, (size_t) URING_DEPTH * URING_BLOCK) != 0) {
+        free(u);
+        return file;
+    }
+    if (!ring_setup(u)) {
+        ring_teardown(u);
+        free(u->buf);
+        free(u);
+        return file;
+    }
+
+    cookie_io_functions_t io = { .read = uring_read, .write = uring_write, .close = uring_close };
+    FILE *stream = fopencookie(u, u->writing ? "w" : "r", io);
+    if (stream == NULL) {
+        ring_teardown(u);
+        free(u->buf);
+        free(u);
+        return file;
+    }
+    // the slots already buffer, so stdio needn't copy everything again
+    setvbuf(stream, NULL, _IONBF, 0);
+    if (!u->writing) {
+        for (size_t i = 0; i < URING_DEPTH; i += 1) {
+            start_read(u, i);
+        }
+    }
+    return stream;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#include <stdio.h>
+
+FILE *uring_open(FILE *file, const char *mode);
@@ -0,0 +1,237 @@
+#include "rsa.h"
+#include "set.h"
+#include "hex.h"
+#include "sha256.h"
+
+#include <stdio.h>
+#include <limits.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+// This function prints out information about how to properly use the file
+// Inputs: void
+// Outputs: void
+
+void message(void) {
+    fprintf(stderr, "SYNOPSIS\n"
+                    "   Verifies signatures made by the sign program.\n"
+                    "\n"
+                    "USAGE\n"
+                    "   ./verify [-hv] [-i infile] -s sigfile [-n pubkey]\n"
+                    "   ./verify [-hv] -b listfile [-t threads] [-n pubkey]\n"
+                    "\n"
+                    "OPTIONS\n"
+                    "   -h              Display program help and usage.\n"
+                    "   -v              Display verbose program output.\n"
+                    "   -i infile       Input file of signed data (default: stdin).\n"
+                    "   -s sigfile      Signature file.\n"
+                    "   -n pbfile       Public key file (default: rsa.pub).\n"
+                    "   -b listfile     Verify every \"file sigfile\" pair listed, one per line.\n"
+                    "   -t threads      Threads for -b (default: number of CPUs).\n");
+    return;
+}
+
+typedef enum { VERBOSE } Verify;
+#define OPTIONS "hvn:i:s:b:t:"
+
+// One (file, signature) pair of a batch and its result
+typedef struct {
+    char *path;
+    char *sigpath;
+    bool ok;
+} Pair;
+
+// What the batch threads share
+typedef struct {
+    Pair *pairs;
+    size_t count;
+    _Atomic size_t next; // next pair to take
+    mpz_ptr n;
+    mpz_ptr e;
+} Batch;
+
+// This function verifies one file against a signature file
+// Inputs: the open data file, the signature file path, n and e = the public key
+// Outputs: true if the signature is valid for the data
+
+static bool verify_file(FILE *infile, const char *sigpath, mpz_t n, mpz_t e) {
+    FILE *sigfile = fopen(sigpath, "r");
+    if (sigfile == NULL) {
+        return false;
+    }
+    mpz_t s;
+    mpz_init(s);
+    HexReader *r = hex_reader_create(sigfile);
+    bool ok = hex_read_mpz(r, s);
+    hex_reader_delete(&r);
+    fclose(sigfile);
+
+    uint8_t digest[SHA256_DIGEST];
+    ok = ok && sha256_file(infile, digest) && rsa_verify_digest(digest, s, e, n);
+    mpz_clear(s);
+    return ok;
+}
+
+// This function is one batch thread: it takes pairs until there are none left
+// Inputs: the batch
+// Outputs: NULL
+
+static void *worker(void *arg) {
+    Batch *batch = (Batch *) arg;
+    size_t i;
+    while ((i = atomic_fetch_add(&batch->next, 1)) < batch->count) {
+        Pair *pair = &batch->pairs[i];
+        FILE *infile = fopen(pair->path, "rb");
+        pair->ok = infile != NULL && verify_file(infile, pair->sigpath, batch->n, batch->e);
+        if (infile != NULL) {
+            fclose(infile);
+        }
+    }
+    return NULL;
+}
+
+// This function verifies every pair in a list file across threads and prints
+// a line for each, in the order listed
+// Inputs: the list file path, the number of threads, n and e = the public key
+// Outputs: 0 if every signature is valid, 1 otherwise
+
+static int verify_batch(char *listpath, long threads, mpz_t n, mpz_t e) {
+    FILE *list = fopen(listpath, "r");
+    if (list == NULL) {
+        fprintf(stderr, "%s: No such file or directory\n", listpath);
+        return 1;
+    }
+    size_t size = 64;
+    Batch batch = { .pairs = (Pair *) calloc(size, sizeof(Pair)), .count = 0, .n = n, .e = e };
+    atomic_init(&batch.next, 0);
+    char path[PATH_MAX], sigpath[PATH_MAX];
+    char line[2 * PATH_MAX + 2];
+    while (fgets(line, sizeof(line), list) != NULL) {
+        if (sscanf(line, "%4095s %4095s", path, sigpath) != 2) {
+            continue;
+        }
+        if (batch.count == size) {
+            size *= 2;
+            batch.pairs = (Pair *) realloc(batch.pairs, size * sizeof(Pair));
+        }
+        batch.pairs[batch.count].path = strdup(path);
+        batch.pairs[batch.count].sigpath = strdup(sigpath);
+        batch.pairs[batch.count].ok = false;
+        batch.count += 1;
+    }
+    fclose(list);
+
+    // the hash kernel is picked before any thread hashes
+    sha256_kernel();
+    threads = (threads > (long) batch.count) ? (long) batch.count : threads;
+    threads = (threads < 1) ? 1 : threads;
+    // this thread works too, and finishes the batch alone if no other starts
+    pthread_t *tids = (pthread_t *) calloc((size_t) threads, sizeof(pthread_t));
+    long started = 1;
+    while (started < threads && pthread_create(&tids[started], NULL, worker, &batch) == 0) {
+        started += 1;
+    }
+    worker(&batch);
+    for (long t = 1; t < started; t += 1) {
+        pthread_join(tids[t], NULL);
+    }
+    free(tids);
+
+    int status = 0;
+    for (size_t i = 0; i < batch.count; i += 1) {
+        printf("%s: %s\n", batch.pairs[i].path, batch.pairs[i].ok ? "OK" : "FAILED");
+        status = batch.pairs[i].ok ? status : 1;
+        free(batch.pairs[i].path);
+        free(batch.pairs[i].sigpath);
+    }
+    free(batch.pairs);
+    return status;
+}
+
+int main(int argc, char **argv) {
+    Set chosen = empty_set();
+    int option = 0;
+    FILE *infile = stdin;
+    char *inpath = "-";
+    char *pbpath = "rsa.pub";
+    char *sigpath = NULL;
+    char *listpath = NULL;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    while ((option = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (option) {
+        case 'h': message(); return 0;
+        case 'v':
+            // verbose printing was chosen
+            chosen = insert_set(VERBOSE, chosen);
+            break;
+        case 'n':
+            // public file path specified
+            pbpath = optarg;
+            break;
+        case 'i':
+            inpath = optarg;
+            infile = fopen(optarg, "rb");
+            if (infile == NULL) {
+                fprintf(stderr, "%s: No such file or directory\n", optarg);
+                return 1;
+            }
+            break;
+        case 's':
+            // signature file specified
+            sigpath = optarg;
+            break;
+        case 'b':
+            // batch list specified
+            listpath = optarg;
+            break;
+        case 't':
+            // number of batch threads specified
+            threads = strtol(optarg, NULL, 10);
+            break;
+        default: message(); return 1;
+        }
+    }
+    if (sigpath == NULL && listpath == NULL) {
+        message();
+        return 1;
+    }
+
+    // read the public key and check that it really is the named user's
+    FILE *pbfile = fopen(pbpath, "r");
+    if (pbfile == NULL) {
+        fprintf(stderr, "%s: No such file or directory\n", pbpath);
+        return 1;
+    }
+    mpz_t n, e, s, name;
+    mpz_inits(n, e, s, name, NULL);
+    char username[LOGIN_NAME_MAX];
+    rsa_read_pub(n, e, s, username, pbfile);
+    fclose(pbfile);
+    mpz_set_str(name, username, 62);
+    int status = 0;
+    if (!rsa_verify(name, s, e, n)) {
+        fprintf(stderr, "Error: invalid key %s.\n", pbpath);
+        status = 1;
+    } else if (member_set(VERBOSE, chosen)) {
+        fprintf(stderr, "key of %s (%zu bits), sha256 (%s)\n", username, mpz_sizeinbase(n, 2),
+            sha256_kernel());
+    }
+
+    if (status == 0 && listpath != NULL) {
+        status = verify_batch(listpath, threads, n, e);
+    } else if (status == 0) {
+        bool ok = verify_file(infile, sigpath, n, e);
+        printf("%s: %s\n", inpath, ok ? "OK" : "FAILED");
+        status = ok ? 0 : 1;
+    }
+
+    mpz_clears(n, e, s, name, NULL);
+    fclose(infile);
+    return status;
+}